@@ -38,6 +38,35 @@ static void RGB2Gray( const int rows
 #pragma endscop
 }
 
+// RGB2Gray followed by the conversion to float in [0,1], in one pass
+static void RGB2Gray_f32( const int rows
+                        , const int cols
+                        , const int src_step
+                        , const int dst_step
+                        , const uint8_t src[static const restrict rows][src_step][3]
+                        , float dst[static const restrict rows][dst_step]
+                        )
+{
+#pragma scop
+    __pencil_assume(rows     >  0);
+    __pencil_assume(cols     >  0);
+    __pencil_assume(src_step >= cols);
+    __pencil_assume(dst_step >= cols);
+
+    __pencil_kill(dst);
+    #pragma pencil independent
+    for ( int q = 0; q < rows; q++ )
+    {
+        #pragma pencil independent
+        for( int w = 0; w < cols; w++ )
+        {
+            dst[q][w] = CV_DESCALE( (src[q][w][2] * B2Y + src[q][w][1] * G2Y + src[q][w][0] * R2Y ), yuv_shift ) / 255.0f;
+        }
+    }
+    __pencil_kill(src);
+#pragma endscop
+}
+
 void pencil_RGB2Gray( const int rows
                     , const int cols
                     , const int src_step
@@ -46,5 +75,16 @@ void pencil_RGB2Gray( const int rows
                     , uint8_t dst[]
                     )
 {
-    RGB2Gray( rows, cols, src_step, dst_step, (const uint8_t(*)[src_step][3])src, (uint8_t(*)[src_step])dst );
+    RGB2Gray( rows, cols, src_step, dst_step, (const uint8_t(*)[src_step][3])src, (uint8_t(*)[dst_step])dst );
+}
+
+void pencil_RGB2Gray_f32( const int rows
+                        , const int cols
+                        , const int src_step
+                        , const int dst_step
+                        , const uint8_t src[]
+                        , float dst[]
+                        )
+{
+    RGB2Gray_f32( rows, cols, src_step, dst_step, (const uint8_t(*)[src_step][3])src, (float(*)[dst_step])dst );
 }
@@ -14,6 +14,15 @@ extern "C" {
                         , uint8_t dst[]
                         );
 
+    // Same as pencil_RGB2Gray, but writes the gray image scaled to [0,1] as float (dst_step counted in floats)
+    void pencil_RGB2Gray_f32( const int rows
+                            , const int cols
+                            , const int src_step
+                            , const int dst_step
+                            , const uint8_t src[]
+                            , float dst[]
+                            );
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,396 @@
+// SIMD CPU color conversions of interleaved 3-channel 8-bit images
+//
+// Every conversion is described by a set of compile-time coefficients and runs
+// through the same kernel: the interleaved triplets are split into one register
+// per channel (pshufb with AVX2, vld3 with NEON), 32 pixels per iteration, the
+// output channels are computed with fixed-point multiply-adds, packed with
+// saturation and interleaved again.
+// The formulas are the ones of the PENCIL kernel and of OpenCV's integer path
+// (RGB2Gray / RGB2YCrCb_i), so the results are bit-exact:
+//   Y  = CV_DESCALE(c0 * s0 + c1 * s1 + c2 * s2, 14)
+//   Cr = CV_DESCALE((s[cr_src] - Y) * c3, 14) + 128
+//   Cb = CV_DESCALE((s[cb_src] - Y) * c4, 14) + 128
+// With AVX2 the channels are widened to 16 bits and paired as (s0,s1) and (s2,1)
+// so that two pmaddwd compute the sum together with the rounding term.
+// When the output does not fit into the last level cache it would only evict the
+// input, so it is written with non-temporal stores.
+
+#ifndef CVT_COLOR_SIMD_HPP
+#define CVT_COLOR_SIMD_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__unix__)
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace carp {
+
+namespace cvt_color {
+
+    enum {
+        yuv_shift  = 14,
+        R2Y        = 4899,
+        G2Y        = 9617,
+        B2Y        = 1868,
+        PIXELS     = 32,    // pixels per SIMD iteration
+    };
+
+    enum kind_t {
+        LUMA,           // one output channel: Y
+        LUMA_CHROMA,    // Y, Cr, Cb
+        SWAP_RB,        // channels 0 and 2 exchanged
+    };
+
+    struct conversion_defaults {
+        enum { c0 = 0, c1 = 0, c2 = 0, c3 = 0, c4 = 0, cr_src = 0, cb_src = 0 };
+    };
+
+    // BIDX is the index of the blue channel in the source
+    template <int BIDX>
+    struct gray_conversion : conversion_defaults {
+        static const kind_t kind = LUMA;
+        enum { dcn = 1
+             , c0 = BIDX == 2 ? R2Y : B2Y, c1 = G2Y, c2 = BIDX == 2 ? B2Y : R2Y
+             };
+    };
+
+    template <int BIDX>
+    struct ycrcb_conversion : conversion_defaults {
+        static const kind_t kind = LUMA_CHROMA;
+        enum { dcn = 3
+             , c0 = BIDX == 2 ? R2Y : B2Y, c1 = G2Y, c2 = BIDX == 2 ? B2Y : R2Y
+             , c3 = 11682, c4 = 9241, cr_src = BIDX ^ 2, cb_src = BIDX
+             };
+    };
+
+    // OpenCV 2.4 runs YUV through the YCrCb code with the table {B2Y, G2Y, R2Y, 8061, 14369},
+    // swapping the first and last entry for BGR input; the same table is kept to stay bit-exact.
+    template <int BIDX>
+    struct yuv_conversion : conversion_defaults {
+        static const kind_t kind = LUMA_CHROMA;
+        enum { dcn = 3
+             , c0 = BIDX == 2 ? B2Y : R2Y, c1 = G2Y, c2 = BIDX == 2 ? R2Y : B2Y
+             , c3 = 8061, c4 = 14369, cr_src = BIDX ^ 2, cb_src = BIDX
+             };
+    };
+
+    struct swap_rb_conversion : conversion_defaults {
+        static const kind_t kind = SWAP_RB;
+        enum { dcn = 3 };
+    };
+
+    typedef gray_conversion<2>  rgb2gray;
+    typedef gray_conversion<0>  bgr2gray;
+    typedef ycrcb_conversion<2> rgb2ycrcb;
+    typedef ycrcb_conversion<0> bgr2ycrcb;
+    typedef yuv_conversion<2>   rgb2yuv;
+    typedef yuv_conversion<0>   bgr2yuv;
+    typedef swap_rb_conversion  swap_rb;
+
+    inline std::size_t last_level_cache_size() {
+        static const std::size_t size = []() -> std::size_t {
+            long result = -1;
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+            result = sysconf(_SC_LEVEL3_CACHE_SIZE);
+            if (result <= 0)
+                result = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+            return result > 0 ? static_cast<std::size_t>(result) : std::size_t(8) << 20;
+        }();
+        return size;
+    }
+
+    inline uint8_t saturate_u8( const int v ) {
+        return static_cast<uint8_t>( v < 0 ? 0 : v > 255 ? 255 : v );
+    }
+
+    template <typename C>
+    inline void convert_pixel( const uint8_t * s, uint8_t * d ) {
+        if ( C::kind == SWAP_RB ) {
+            const uint8_t t = s[0];
+            d[1] = s[1];
+            d[0] = s[2];
+            d[2] = t;
+            return;
+        }
+        const int y = ( s[0] * C::c0 + s[1] * C::c1 + s[2] * C::c2 + (1 << (yuv_shift - 1)) ) >> yuv_shift;
+        if ( C::kind == LUMA_CHROMA ) {
+            const int cr = ( ( ( s[C::cr_src] - y ) * C::c3 + (1 << (yuv_shift - 1)) ) >> yuv_shift ) + 128;
+            const int cb = ( ( ( s[C::cb_src] - y ) * C::c4 + (1 << (yuv_shift - 1)) ) >> yuv_shift ) + 128;
+            d[0] = static_cast<uint8_t>(y);
+            d[1] = saturate_u8(cr);
+            d[2] = saturate_u8(cb);
+        } else {
+            d[0] = static_cast<uint8_t>(y);
+        }
+    }
+
+    inline uint8_t gray( const uint8_t * p ) {
+        uint8_t result;
+        convert_pixel<rgb2gray>( p, &result );
+        return result;
+    }
+
+#if defined(__AVX2__)
+    // pshufb mask moving byte (3 * i + channel) of the `part`th 16 bytes to byte i, in both lanes
+    inline __m256i deinterleave_mask( const int channel, const int part ) {
+        alignas(32) int8_t mask[32];
+        for ( int i = 0; i < 16; ++i ) {
+            const int s = 3 * i + channel - 16 * part;
+            mask[i] = mask[i + 16] = static_cast<int8_t>( s >= 0 && s < 16 ? s : -1 );
+        }
+        return _mm256_load_si256( reinterpret_cast<const __m256i*>(mask) );
+    }
+
+    // the inverse: byte j of the `part`th 16 output bytes comes from byte (16 * part + j) / 3 of its channel
+    inline __m256i interleave_mask( const int channel, const int part ) {
+        alignas(32) int8_t mask[32];
+        for ( int j = 0; j < 16; ++j ) {
+            const int b = 16 * part + j;
+            mask[j] = mask[j + 16] = static_cast<int8_t>( b % 3 == channel ? b / 3 : -1 );
+        }
+        return _mm256_load_si256( reinterpret_cast<const __m256i*>(mask) );
+    }
+
+    // Lane 0 of every register holds pixels 0..15, lane 1 pixels 16..31.
+    struct shuffles {
+        __m256i split[3][3];
+        __m256i merge[3][3];
+
+        shuffles() {
+            for ( int channel = 0; channel < 3; ++channel )
+                for ( int part = 0; part < 3; ++part ) {
+                    split[channel][part] = deinterleave_mask( channel, part );
+                    merge[part][channel] = interleave_mask( channel, part );
+                }
+        }
+
+        static __m256i load( const uint8_t * p, const int part ) {
+            const __m128i lo = _mm_loadu_si128( reinterpret_cast<const __m128i*>(p + 16 * part) );
+            const __m128i hi = _mm_loadu_si128( reinterpret_cast<const __m128i*>(p + 16 * part + 48) );
+            return _mm256_inserti128_si256( _mm256_castsi128_si256(lo), hi, 1 );
+        }
+
+        void deinterleave( const uint8_t * p, __m256i c[3] ) const {
+            const __m256i a = load( p, 0 );
+            const __m256i b = load( p, 1 );
+            const __m256i d = load( p, 2 );
+            for ( int channel = 0; channel < 3; ++channel )
+                c[channel] = _mm256_or_si256( _mm256_or_si256( _mm256_shuffle_epi8( a, split[channel][0] )
+                                                             , _mm256_shuffle_epi8( b, split[channel][1] ) )
+                                            , _mm256_shuffle_epi8( d, split[channel][2] ) );
+        }
+
+        template <bool STREAM>
+        void interleave( const __m256i c[3], uint8_t * p ) const {
+            __m256i part[3];
+            for ( int q = 0; q < 3; ++q )
+                part[q] = _mm256_or_si256( _mm256_or_si256( _mm256_shuffle_epi8( c[0], merge[q][0] )
+                                                          , _mm256_shuffle_epi8( c[1], merge[q][1] ) )
+                                         , _mm256_shuffle_epi8( c[2], merge[q][2] ) );
+            // bytes 0..47 are the low lanes of the three parts, bytes 48..95 the high lanes
+            const __m256i out[3] = { _mm256_permute2x128_si256( part[0], part[1], 0x20 )
+                                   , _mm256_permute2x128_si256( part[2], part[0], 0x30 )
+                                   , _mm256_permute2x128_si256( part[1], part[2], 0x31 )
+                                   };
+            for ( int q = 0; q < 3; ++q )
+                store<STREAM>( p + 32 * q, out[q] );
+        }
+
+        template <bool STREAM>
+        static void store( uint8_t * p, const __m256i v ) {
+            if (STREAM)
+                _mm256_stream_si256( reinterpret_cast<__m256i*>(p), v );
+            else
+                _mm256_storeu_si256( reinterpret_cast<__m256i*>(p), v );
+        }
+    };
+
+    // the sums can be negative for the chroma channels, so the shift is arithmetic
+    inline __m256i descale_epi32( const __m256i sum ) {
+        return _mm256_srai_epi32( sum, yuv_shift );
+    }
+
+    // luma and chroma channels for one 16-bit half (8 pixels per lane)
+    template <typename C>
+    inline void convert_half( const __m256i s16[3], __m256i out16[3] ) {
+        const __m256i one       = _mm256_set1_epi16( 1 );
+        const __m256i coeffs_01 = _mm256_set1_epi32( (C::c1 << 16) | C::c0 );
+        const __m256i coeffs_2r = _mm256_set1_epi32( ((1 << (yuv_shift - 1)) << 16) | C::c2 );
+
+        const __m256i s01_lo = _mm256_unpacklo_epi16( s16[0], s16[1] ), s01_hi = _mm256_unpackhi_epi16( s16[0], s16[1] );
+        const __m256i s21_lo = _mm256_unpacklo_epi16( s16[2], one ),    s21_hi = _mm256_unpackhi_epi16( s16[2], one );
+        const __m256i y_lo = descale_epi32( _mm256_add_epi32( _mm256_madd_epi16( s01_lo, coeffs_01 ), _mm256_madd_epi16( s21_lo, coeffs_2r ) ) );
+        const __m256i y_hi = descale_epi32( _mm256_add_epi32( _mm256_madd_epi16( s01_hi, coeffs_01 ), _mm256_madd_epi16( s21_hi, coeffs_2r ) ) );
+        out16[0] = _mm256_packs_epi32( y_lo, y_hi );
+
+        if ( C::kind == LUMA_CHROMA ) {
+            const __m256i chroma_bias = _mm256_set1_epi16( 128 );
+            const int coeffs[2] = { C::c3, C::c4 };
+            const int sources[2] = { C::cr_src, C::cb_src };
+            for ( int k = 0; k < 2; ++k ) {
+                const __m256i coeffs_dr = _mm256_set1_epi32( ((1 << (yuv_shift - 1)) << 16) | coeffs[k] );
+                const __m256i diff = _mm256_sub_epi16( s16[sources[k]], out16[0] );
+                const __m256i c_lo = descale_epi32( _mm256_madd_epi16( _mm256_unpacklo_epi16( diff, one ), coeffs_dr ) );
+                const __m256i c_hi = descale_epi32( _mm256_madd_epi16( _mm256_unpackhi_epi16( diff, one ), coeffs_dr ) );
+                out16[k + 1] = _mm256_add_epi16( _mm256_packs_epi32( c_lo, c_hi ), chroma_bias );
+            }
+        }
+    }
+
+    template <typename C, bool STREAM>
+    inline void convert_row( const shuffles & shuffle, const uint8_t * src, uint8_t * dst, const int cols ) {
+        const __m256i zero = _mm256_setzero_si256();
+
+        int w = 0;
+        if (STREAM)
+            for ( ; w < cols && (reinterpret_cast<std::uintptr_t>(dst + C::dcn * w) & 31); ++w )
+                convert_pixel<C>( src + 3 * w, dst + C::dcn * w );
+
+        for ( ; w + PIXELS <= cols; w += PIXELS ) {
+            __m256i s[3];
+            shuffle.deinterleave( src + 3 * w, s );
+
+            if ( C::kind == SWAP_RB ) {
+                const __m256i d[3] = { s[2], s[1], s[0] };
+                shuffle.interleave<STREAM>( d, dst + 3 * w );
+                continue;
+            }
+
+            __m256i d16[2][3];
+            for ( int half = 0; half < 2; ++half ) {
+                __m256i s16[3];
+                for ( int channel = 0; channel < 3; ++channel )
+                    s16[channel] = half ? _mm256_unpackhi_epi8( s[channel], zero ) : _mm256_unpacklo_epi8( s[channel], zero );
+                convert_half<C>( s16, d16[half] );
+            }
+            // the unpack/pack pairs stay within the lanes, so the pixel order is restored
+            __m256i d[3];
+            for ( int channel = 0; channel < C::dcn; ++channel )
+                d[channel] = _mm256_packus_epi16( d16[0][channel], d16[1][channel] );
+
+            if ( C::dcn == 1 )
+                shuffles::store<STREAM>( dst + w, d[0] );
+            else
+                shuffle.interleave<STREAM>( d, dst + 3 * w );
+        }
+
+        for ( ; w < cols; ++w )
+            convert_pixel<C>( src + 3 * w, dst + C::dcn * w );
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    template <typename C>
+    inline int16x8_t luma_s16( const uint16x8_t s0, const uint16x8_t s1, const uint16x8_t s2 ) {
+        uint32x4_t lo = vmull_n_u16( vget_low_u16(s0), C::c0 );
+        uint32x4_t hi = vmull_n_u16( vget_high_u16(s0), C::c0 );
+        lo = vmlal_n_u16( lo, vget_low_u16(s1), C::c1 );
+        hi = vmlal_n_u16( hi, vget_high_u16(s1), C::c1 );
+        lo = vmlal_n_u16( lo, vget_low_u16(s2), C::c2 );
+        hi = vmlal_n_u16( hi, vget_high_u16(s2), C::c2 );
+        // vrshrn adds 1 << (yuv_shift - 1) before shifting, which is CV_DESCALE
+        return vreinterpretq_s16_u16( vcombine_u16( vrshrn_n_u32( lo, yuv_shift ), vrshrn_n_u32( hi, yuv_shift ) ) );
+    }
+
+    inline int16x8_t chroma_s16( const uint16x8_t s, const int16x8_t y, const int16_t coeff ) {
+        const int16x8_t diff = vsubq_s16( vreinterpretq_s16_u16(s), y );
+        const int32x4_t lo = vmull_n_s16( vget_low_s16(diff), coeff );
+        const int32x4_t hi = vmull_n_s16( vget_high_s16(diff), coeff );
+        return vaddq_s16( vcombine_s16( vrshrn_n_s32( lo, yuv_shift ), vrshrn_n_s32( hi, yuv_shift ) ), vdupq_n_s16(128) );
+    }
+
+    template <typename C>
+    inline void convert_8( const uint8x8_t s8[3], uint8x8_t d8[3] ) {
+        const uint16x8_t s[3] = { vmovl_u8(s8[0]), vmovl_u8(s8[1]), vmovl_u8(s8[2]) };
+        const int16x8_t y = luma_s16<C>( s[0], s[1], s[2] );
+        d8[0] = vqmovun_s16(y);
+        if ( C::kind == LUMA_CHROMA ) {
+            d8[1] = vqmovun_s16( chroma_s16( s[C::cr_src], y, C::c3 ) );
+            d8[2] = vqmovun_s16( chroma_s16( s[C::cb_src], y, C::c4 ) );
+        }
+    }
+
+    template <typename C>
+    inline void convert_16( const uint8x16x3_t s, uint8_t * dst ) {
+        if ( C::kind == SWAP_RB ) {
+            uint8x16x3_t d;
+            d.val[0] = s.val[2];
+            d.val[1] = s.val[1];
+            d.val[2] = s.val[0];
+            vst3q_u8( dst, d );
+            return;
+        }
+        uint8x8_t lo[3], hi[3];
+        const uint8x8_t s_lo[3] = { vget_low_u8 (s.val[0]), vget_low_u8 (s.val[1]), vget_low_u8 (s.val[2]) };
+        const uint8x8_t s_hi[3] = { vget_high_u8(s.val[0]), vget_high_u8(s.val[1]), vget_high_u8(s.val[2]) };
+        convert_8<C>( s_lo, lo );
+        convert_8<C>( s_hi, hi );
+        if ( C::dcn == 1 ) {
+            vst1q_u8( dst, vcombine_u8( lo[0], hi[0] ) );
+        } else {
+            uint8x16x3_t d;
+            for ( int channel = 0; channel < 3; ++channel )
+                d.val[channel] = vcombine_u8( lo[channel], hi[channel] );
+            vst3q_u8( dst, d );
+        }
+    }
+
+    template <typename C>
+    inline void convert_row( const uint8_t * src, uint8_t * dst, const int cols ) {
+        int w = 0;
+        for ( ; w + PIXELS <= cols; w += PIXELS ) {
+            convert_16<C>( vld3q_u8( src + 3 * w ),      dst + C::dcn * w );
+            convert_16<C>( vld3q_u8( src + 3 * w + 48 ), dst + C::dcn * (w + 16) );
+        }
+        for ( ; w < cols; ++w )
+            convert_pixel<C>( src + 3 * w, dst + C::dcn * w );
+    }
+#else
+    template <typename C>
+    inline void convert_row( const uint8_t * src, uint8_t * dst, const int cols ) {
+        for ( int w = 0; w < cols; ++w )
+            convert_pixel<C>( src + 3 * w, dst + C::dcn * w );
+    }
+#endif
+}
+
+// Converts an interleaved 3-channel image with the conversion C (e.g. cvt_color::rgb2ycrcb).
+// As in pencil_RGB2Gray, src_step and dst_step are counted in pixels of the source and destination.
+template <typename C>
+inline void cvt_color_simd( const int rows, const int cols, const int src_step, const int dst_step, const uint8_t src[], uint8_t dst[] )
+{
+    const std::size_t src_pitch = std::size_t(src_step) * 3;
+    const std::size_t dst_pitch = std::size_t(dst_step) * C::dcn;
+#if defined(__AVX2__)
+    const cvt_color::shuffles shuffle;
+    const bool stream = std::size_t(rows) * dst_pitch > cvt_color::last_level_cache_size();
+    for ( int q = 0; q < rows; ++q ) {
+        if (stream)
+            cvt_color::convert_row<C, true >( shuffle, src + q * src_pitch, dst + q * dst_pitch, cols );
+        else
+            cvt_color::convert_row<C, false>( shuffle, src + q * src_pitch, dst + q * dst_pitch, cols );
+    }
+    if (stream)
+        _mm_sfence();
+#else
+    for ( int q = 0; q < rows; ++q )
+        cvt_color::convert_row<C>( src + q * src_pitch, dst + q * dst_pitch, cols );
+#endif
+}
+
+// Same interface as pencil_RGB2Gray.
+inline void RGB2Gray_simd( const int rows, const int cols, const int src_step, const int dst_step, const uint8_t src[], uint8_t dst[] )
+{
+    cvt_color_simd<cvt_color::rgb2gray>( rows, cols, src_step, dst_step, src, dst );
+}
+
+} // namespace carp
+
+#endif // CVT_COLOR_SIMD_HPP
@@ -1,11 +1,14 @@
 #include "utility.hpp"
 #include "cvt_color.pencil.h"
+#include "cvt_color_simd.hpp"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/ocl/ocl.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
 #include <prl.h>
 #include <chrono>
+#include <algorithm>
 
 void time_cvtColor( const std::vector<carp::record_t>& pool, size_t iterations)
 {
@@ -15,9 +18,9 @@ void time_cvtColor( const std::vector<carp::record_t>& pool, size_t iterations)
     for ( auto & record : pool ) {
         for(size_t i = 0; i < iterations; ++i) {
             cv::Mat cpuimg = record.cpuimg();
-            cv::Mat cpu_result, gpu_result, pen_result;
+            cv::Mat cpu_result, gpu_result, pen_result, simd_result, cpu_result_f32, pen_result_f32;
 
-            std::chrono::duration<double> elapsed_time_cpu, elapsed_time_gpu_p_copy;
+            std::chrono::duration<double> elapsed_time_cpu, elapsed_time_gpu_p_copy, elapsed_time_simd, elapsed_time_cpu_f32, elapsed_time_pen_f32;
             {
                 const auto start = std::chrono::high_resolution_clock::now();
                 cv::cvtColor( cpuimg, cpu_result, CV_RGB2GRAY );
@@ -60,18 +63,105 @@ void time_cvtColor( const std::vector<carp::record_t>& pool, size_t iterations)
                 // Dump execution times for PENCIL code.
                 prl_timings_dump();
             }
+            {
+                simd_result.create( cpu_result.rows, cpu_result.cols, CV_8U );
+
+                const auto start = std::chrono::high_resolution_clock::now();
+                carp::RGB2Gray_simd( cpuimg.rows, cpuimg.cols, cpuimg.step1()/cpuimg.channels(), simd_result.step1()
+                                   , cpuimg.data, simd_result.data
+                                   );
+                const auto end = std::chrono::high_resolution_clock::now();
+                elapsed_time_simd = end - start;
+            }
+            {
+                // gray image normalized to [0,1]: two passes with OpenCV, one fused PENCIL kernel
+                const auto cpu_start = std::chrono::high_resolution_clock::now();
+                cv::cvtColor( cpuimg, cpu_result_f32, CV_RGB2GRAY );
+                cpu_result_f32.convertTo( cpu_result_f32, CV_32F, 1.0/255. );
+                const auto cpu_end = std::chrono::high_resolution_clock::now();
+                elapsed_time_cpu_f32 = cpu_end - cpu_start;
+
+                pen_result_f32.create( cpu_result.rows, cpu_result.cols, CV_32F );
+                const auto pen_start = std::chrono::high_resolution_clock::now();
+                pencil_RGB2Gray_f32( cpuimg.rows, cpuimg.cols, cpuimg.step1()/cpuimg.channels(), pen_result_f32.step1()
+                                   , cpuimg.data, pen_result_f32.ptr<float>()
+                                   );
+                const auto pen_end = std::chrono::high_resolution_clock::now();
+                elapsed_time_pen_f32 = pen_end - pen_start;
+            }
+            if (i == 0)
+            {
+                // both strides differ from the row width: a cropped source written into a padded destination
+                const cv::Rect roi( 1, 1, std::max(cpuimg.cols - 35, 1), std::max(cpuimg.rows - 2, 1) );
+                cv::Mat src_roi = cpuimg(roi);
+                cv::Mat cpu_roi, pen_padded( roi.height, roi.width + 29, CV_8U, cv::Scalar(0) ), simd_padded( roi.height, roi.width + 29, CV_8U, cv::Scalar(0) );
+                cv::cvtColor( src_roi, cpu_roi, CV_RGB2GRAY );
+                pencil_RGB2Gray( src_roi.rows, src_roi.cols, src_roi.step1()/src_roi.channels(), pen_padded.step1(), src_roi.data, pen_padded.data );
+                carp::RGB2Gray_simd( src_roi.rows, src_roi.cols, src_roi.step1()/src_roi.channels(), simd_padded.step1(), src_roi.data, simd_padded.data );
+                cv::Mat pen_roi = pen_padded( cv::Rect( 0, 0, roi.width, roi.height ) );
+                cv::Mat simd_roi = simd_padded( cv::Rect( 0, 0, roi.width, roi.height ) );
+                if ( cv::countNonZero( pen_roi != cpu_roi ) || cv::countNonZero( simd_roi != cpu_roi ) ) {
+                    throw std::runtime_error("The strided results are not equivalent with the CPU results.");
+                }
+            }
 
             // Verifying the results
             float opencl_err = cv::norm(gpu_result - cpu_result);
             float pencil_err = cv::norm(pen_result - cpu_result);
-            if ( opencl_err > 0.01 || pencil_err > 0.01 ) {
+            // the SIMD variant has to be bit-exact
+            float pencil_f32_err = cv::norm( pen_result_f32, cpu_result_f32, cv::NORM_INF );
+            if ( opencl_err > 0.01 || pencil_err > 0.01 || cv::countNonZero( simd_result != cpu_result ) || pencil_f32_err > 1e-6 ) {
                 cv::imwrite( "cpu_cvtcolor.png", cpu_result );
                 cv::imwrite( "gpu_cvtcolor.png", gpu_result );
                 cv::imwrite( "pen_cvtcolor.png", pen_result );
+                cv::imwrite( "simd_cvtcolor.png", simd_result );
                 throw std::runtime_error("The GPU results are not equivalent with the CPU results.");
             }
             // Dump execution times for OpenCV calls.
             timing.print(elapsed_time_cpu, elapsed_time_gpu_p_copy);
+            timing.print( "SIMD RGB2Gray (CPU)", elapsed_time_simd );
+            timing.print( "RGB2Gray + convertTo f32 (OpenCV CPU)", elapsed_time_cpu_f32 );
+            timing.print( "fused RGB2Gray_f32 (PENCIL)", elapsed_time_pen_f32 );
+        }
+    }
+}
+
+// The CPU color-matrix conversions have to be bit-exact with cv::cvtColor
+template <typename Conversion>
+void time_color_matrix( const std::vector<carp::record_t>& pool, size_t iterations, const int code, const std::string & name )
+{
+    carp::Timing timing(name);
+    for ( auto & record : pool ) {
+        cv::Mat cpuimg = record.cpuimg();
+        for(size_t i = 0; i < iterations; ++i) {
+            cv::Mat cpu_result, simd_result;
+
+            std::chrono::duration<double> elapsed_time_cpu, elapsed_time_simd;
+            {
+                const auto start = std::chrono::high_resolution_clock::now();
+                cv::cvtColor( cpuimg, cpu_result, code );
+                const auto end = std::chrono::high_resolution_clock::now();
+                elapsed_time_cpu = end - start;
+            }
+            {
+                simd_result.create( cpu_result.rows, cpu_result.cols, cpu_result.type() );
+
+                const auto start = std::chrono::high_resolution_clock::now();
+                carp::cvt_color_simd<Conversion>( cpuimg.rows, cpuimg.cols, cpuimg.step1()/cpuimg.channels(), simd_result.step1()/simd_result.channels()
+                                                , cpuimg.data, simd_result.data
+                                                );
+                const auto end = std::chrono::high_resolution_clock::now();
+                elapsed_time_simd = end - start;
+            }
+
+            // Verifying the results
+            if ( cv::norm( cpu_result, simd_result, cv::NORM_INF ) != 0 ) {
+                cv::imwrite( "cpu_" + name + ".png", cpu_result );
+                cv::imwrite( "simd_" + name + ".png", simd_result );
+                throw std::runtime_error("The SIMD " + name + " results are not equivalent with the CPU results.");
+            }
+            timing.print( "OpenCV cvtColor (CPU)", elapsed_time_cpu );
+            timing.print( "SIMD color matrix (CPU)", elapsed_time_simd );
         }
     }
 }
@@ -93,6 +183,14 @@ int main(int argc, char* argv[])
 
     time_cvtColor( pool, num_iterations );
 
+    time_color_matrix<carp::cvt_color::rgb2gray >( pool, num_iterations, CV_RGB2GRAY,   "RGB2GRAY"   );
+    time_color_matrix<carp::cvt_color::bgr2gray >( pool, num_iterations, CV_BGR2GRAY,   "BGR2GRAY"   );
+    time_color_matrix<carp::cvt_color::rgb2ycrcb>( pool, num_iterations, CV_RGB2YCrCb,  "RGB2YCrCb"  );
+    time_color_matrix<carp::cvt_color::bgr2ycrcb>( pool, num_iterations, CV_BGR2YCrCb,  "BGR2YCrCb"  );
+    time_color_matrix<carp::cvt_color::rgb2yuv  >( pool, num_iterations, CV_RGB2YUV,    "RGB2YUV"    );
+    time_color_matrix<carp::cvt_color::bgr2yuv  >( pool, num_iterations, CV_BGR2YUV,    "BGR2YUV"    );
+    time_color_matrix<carp::cvt_color::swap_rb  >( pool, num_iterations, CV_BGR2RGB,    "BGR2RGB"    );
+
     prl_shutdown();
     return EXIT_SUCCESS;
 }
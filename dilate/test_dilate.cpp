@@ -17,9 +17,11 @@ void time_dilate( const std::vector<carp::record_t>& pool, const std::vector<int
     for ( int q=0; q<iteration; q++ ) {
         for ( auto & item : pool ) {
             for ( auto & elemsize : elemsizes ) {
-                // acquiring the image for the test
-                cv::Mat cpu_gray;
-                cv::cvtColor( item.cpuimg(), cpu_gray, CV_RGB2GRAY );
+                // decoding straight to grayscale, the decoder skips the color conversion
+                const auto decode_start = std::chrono::high_resolution_clock::now();
+                cv::Mat cpu_gray = item.grayimg();
+                const auto decode_end = std::chrono::high_resolution_clock::now();
+                timing.print( "decode (gray)", decode_end - decode_start );
 
                 cv::Point anchor( elemsize/2, elemsize/2 );
                 cv::Size ksize(elemsize, elemsize);
@@ -1,5 +1,6 @@
 #include "utility.hpp"
 #include "filter2D.pencil.h"
+#include "cvt_color.pencil.h"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/ocl/ocl.hpp>
@@ -16,9 +17,10 @@ void time_filter2D( const std::vector<carp::record_t>& pool, int iteration )
 
     for ( int q=0; q<iteration; q++ ) {
         for ( auto & item : pool ) {
-            cv::Mat cpu_gray;
-            cv::cvtColor( item.cpuimg(), cpu_gray, CV_RGB2GRAY );
-            cpu_gray.convertTo( cpu_gray, CV_32F, 1.0/255. );
+            // gray conversion and normalization to [0,1] in one pass
+            const cv::Mat rgb = item.cpuimg();
+            cv::Mat cpu_gray( rgb.size(), CV_32F );
+            pencil_RGB2Gray_f32( rgb.rows, rgb.cols, rgb.step1()/rgb.channels(), cpu_gray.step1(), rgb.data, cpu_gray.ptr<float>() );
 
             float kernel_data[] = {-1, -1, -1
                                   , 0,  0,  0
@@ -1,5 +1,6 @@
 #include "utility.hpp"
 #include "gaussian.pencil.h"
+#include "cvt_color.pencil.h"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/ocl/ocl.hpp>
@@ -21,10 +22,10 @@ void time_gaussian( const std::vector<carp::record_t>& pool, const std::vector<i
         double gaussY = 9.;
 
         for ( auto & item : pool ) {
-            cv::Mat cpu_gray;
-
-            cv::cvtColor( item.cpuimg(), cpu_gray, CV_RGB2GRAY );
-            cpu_gray.convertTo( cpu_gray, CV_32F, 1.0/255. );
+            // gray conversion and normalization to [0,1] in one pass
+            const cv::Mat rgb = item.cpuimg();
+            cv::Mat cpu_gray( rgb.size(), CV_32F );
+            pencil_RGB2Gray_f32( rgb.rows, rgb.cols, rgb.step1()/rgb.channels(), cpu_gray.step1(), rgb.data, cpu_gray.ptr<float>() );
 
             cv::Mat cpu_result, gpu_result, pen_result;
             std::chrono::duration<double> elapsed_time_cpu, elapsed_time_gpu_p_copy;
@@ -0,0 +1,326 @@
+// CPU histograms of 8-bit images
+//
+// pencil_calcHist counts every pixel into one shared histogram, so a parallel
+// version would contend on its HISTOGRAM_BINS counters. Here every task counts its
+// rows into a private histogram instead; tbb::parallel_reduce splits the rows
+// between the threads and joins the private histograms pairwise, i.e. in a tree.
+// Within a thread, runs of equal pixels would make every increment wait for the
+// store of the previous one, so the pixels are loaded 8 at a time and counted
+// round-robin into HIST_BANKS interleaved sub-histograms that are summed at the end.
+// calc_hist_sampled estimates the histogram from a fraction of the pixels only.
+// The bins are a compile-time parameter (uniform_bins), so that the bin of a pixel
+// compiles to a shift for power-of-two bins and to a table lookup otherwise;
+// calc_hist_joint counts two channels of an interleaved image (e.g. hue and
+// saturation) into a 2D histogram in one pass.
+
+#ifndef CALC_HIST_HPP
+#define CALC_HIST_HPP
+
+#include "histogram.pencil.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#ifdef WITH_TBB
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+#endif
+
+namespace carp {
+
+namespace hist {
+
+    enum {
+        ROW_GRAIN  = 16,    // rows counted by a task at least
+        HIST_BANKS = 4,     // interleaved sub-histograms
+    };
+
+    template <int N>
+    struct static_log2 {
+        enum { value = 1 + static_log2<N / 2>::value };
+    };
+
+    template <>
+    struct static_log2<1> {
+        enum { value = 0 };
+    };
+
+    // BINS equal bins over the values [LOW, HIGH), as the uniform ranges of cv::calcHist.
+    // A power of two bins over all the 8-bit values is a shift; any other binning is looked
+    // up in a table of all the 8-bit values, filled by the constructor, so no loop branches
+    // on the range. Values out of the range go to the extra bin BINS.
+    // cv::calcHist computes the bin in double precision; with LOW != 0 and bins that are not
+    // powers of two, it may put a value that is exactly on a bin boundary in the bin below.
+    template <int BINS, int LOW = 0, int HIGH = HISTOGRAM_BINS>
+    struct uniform_bins {
+        static_assert( BINS > 0 && 0 <= LOW && LOW < HIGH && HIGH <= HISTOGRAM_BINS, "The bins must cover a range of 8-bit values." );
+
+        enum {
+            bins         = BINS,
+            width        = HIGH - LOW,
+            power_of_two = (BINS & (BINS - 1)) == 0 && (width & (width - 1)) == 0 && width >= BINS,
+            shift        = static_log2<power_of_two ? width / BINS : 1>::value,
+            direct       = power_of_two && width == HISTOGRAM_BINS,
+        };
+
+        static int index( const int value ) {
+            const int offset = value - LOW;
+            if ( offset < 0 || offset >= width )
+                return BINS;
+            return power_of_two ? offset >> shift : offset * BINS / width;
+        }
+
+        uint16_t table[HISTOGRAM_BINS];
+
+        uniform_bins() {
+            if ( !direct )
+                for ( int v = 0; v < HISTOGRAM_BINS; ++v )
+                    table[v] = static_cast<uint16_t>( index(v) );
+        }
+
+        int operator()( const int value ) const {
+            return direct ? value >> shift : table[value];
+        }
+    };
+
+    // adds the pixels of rows [row_begin, row_end) to hist[Bins::bins]
+    template <typename Bins = uniform_bins<HISTOGRAM_BINS> >
+    inline void count_rows( const int row_begin, const int row_end, const int cols, const int step, const uint8_t image[], int hist[] ) {
+        const Bins bin_of;
+        uint32_t banks[HIST_BANKS][Bins::bins + 1];
+        std::memset( banks, 0, sizeof(banks) );
+
+        for ( int r = row_begin; r < row_end; ++r ) {
+            const uint8_t * row = image + std::size_t(r) * step;
+            int c = 0;
+            for ( ; c + 8 <= cols; c += 8 ) {
+                uint64_t pixels;
+                std::memcpy( &pixels, row + c, sizeof(pixels) );
+                // byte k goes to bank k % HIST_BANKS: a run of equal pixels hits the same
+                // counter only every HIST_BANKS bytes
+                ++banks[0 % HIST_BANKS][bin_of( pixels        & 0xFF)];
+                ++banks[1 % HIST_BANKS][bin_of((pixels >>  8) & 0xFF)];
+                ++banks[2 % HIST_BANKS][bin_of((pixels >> 16) & 0xFF)];
+                ++banks[3 % HIST_BANKS][bin_of((pixels >> 24) & 0xFF)];
+                ++banks[4 % HIST_BANKS][bin_of((pixels >> 32) & 0xFF)];
+                ++banks[5 % HIST_BANKS][bin_of((pixels >> 40) & 0xFF)];
+                ++banks[6 % HIST_BANKS][bin_of((pixels >> 48) & 0xFF)];
+                ++banks[7 % HIST_BANKS][bin_of( pixels >> 56        )];
+            }
+            for ( ; c < cols; ++c )
+                ++banks[c % HIST_BANKS][bin_of(row[c])];
+        }
+
+        for ( int k = 0; k < HIST_BANKS; ++k )
+            for ( int b = 0; b < Bins::bins; ++b )
+                hist[b] += banks[k][b];
+    }
+
+    enum sampling_t {
+        SAMPLE_STRIDE,      // the top left pixel of every grid cell
+        SAMPLE_JITTERED,    // a random row per band of cells, a random column per cell
+    };
+
+    // Grid cells of about 1 / rate pixels, as square as the rate allows.
+    inline void sampling_grid( const double rate, int & row_step, int & col_step ) {
+        const double cell = 1.0 / std::min( std::max( rate, 1e-6 ), 1.0 );
+        row_step = std::max( 1, static_cast<int>( std::floor( std::sqrt(cell) ) ) );
+        col_step = std::max( 1, static_cast<int>( std::floor( cell / row_step + 0.5 ) ) );
+    }
+
+    // xorshift32; the sample positions only need to avoid aliasing with the image content
+    inline uint32_t next_random( uint32_t & state ) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // uniform in [0, n) without a division
+    inline int random_below( uint32_t & state, const int n ) {
+        return static_cast<int>( ( uint64_t(next_random(state)) * uint32_t(n) ) >> 32 );
+    }
+
+#ifdef WITH_TBB
+    // parallel_reduce body owning a private histogram
+    struct partial {
+        const int cols, step;
+        const uint8_t * const image;
+        int hist[HISTOGRAM_BINS];
+
+        partial( const int cols_, const int step_, const uint8_t * image_ )
+            : cols(cols_), step(step_), image(image_)
+        {
+            std::fill( hist, hist + HISTOGRAM_BINS, 0 );
+        }
+
+        partial( const partial & other, tbb::split )
+            : cols(other.cols), step(other.step), image(other.image)
+        {
+            std::fill( hist, hist + HISTOGRAM_BINS, 0 );
+        }
+
+        void operator()( const tbb::blocked_range<int> & range ) {
+            count_rows( range.begin(), range.end(), cols, step, image, hist );
+        }
+
+        void join( const partial & other ) {
+            for ( int b = 0; b < HISTOGRAM_BINS; ++b )
+                hist[b] += other.hist[b];
+        }
+    };
+#endif
+}
+
+// Histogram with the bins of Bins, e.g. uniform_bins<32> is cv::calcHist with histSize 32 and range [0, 256).
+template <typename Bins>
+inline void calc_hist_uniform( const int rows, const int cols, const int step, const uint8_t image[], int hist[Bins::bins] )
+{
+    std::fill( hist, hist + Bins::bins, 0 );
+    hist::count_rows<Bins>( 0, rows, cols, step, image, hist );
+}
+
+// Joint histogram of the channels first and second of an interleaved image with the given number
+// of channels, in one pass. hist is Bins0::bins x Bins1::bins, row major, as the 2D cv::calcHist;
+// for hue and saturation, calc_hist_joint< uniform_bins<30, 0, 180>, uniform_bins<32> >( ..., 3, 0, 1, hist ).
+template <typename Bins0, typename Bins1>
+inline void calc_hist_joint( const int rows, const int cols, const int step, const int channels, const uint8_t image[]
+                           , const int first, const int second, int hist[]
+                           )
+{
+    // one more row and column for the values out of range, dropped when the banks are summed
+    enum { ROW = Bins1::bins + 1, BANK = (Bins0::bins + 1) * ROW };
+    const Bins0 bin0_of;
+    const Bins1 bin1_of;
+    std::vector<uint32_t> banks( hist::HIST_BANKS * BANK, 0 );
+    uint32_t * bank[hist::HIST_BANKS];
+    for ( int k = 0; k < hist::HIST_BANKS; ++k )
+        bank[k] = &banks[k * BANK];
+
+    for ( int r = 0; r < rows; ++r ) {
+        const uint8_t * pixel = image + std::size_t(r) * step;
+        int c = 0;
+        for ( ; c + hist::HIST_BANKS <= cols; c += hist::HIST_BANKS )
+            for ( int k = 0; k < hist::HIST_BANKS; ++k, pixel += channels )
+                ++bank[k][bin0_of(pixel[first]) * ROW + bin1_of(pixel[second])];
+        for ( ; c < cols; ++c, pixel += channels )
+            ++bank[0][bin0_of(pixel[first]) * ROW + bin1_of(pixel[second])];
+    }
+
+    for ( int b0 = 0; b0 < Bins0::bins; ++b0 )
+        for ( int b1 = 0; b1 < Bins1::bins; ++b1 ) {
+            const int b = b0 * ROW + b1;
+            uint32_t count = 0;
+            for ( int k = 0; k < hist::HIST_BANKS; ++k )
+                count += bank[k][b];
+            hist[b0 * Bins1::bins + b1] = count;
+        }
+}
+
+// Same interface and result as pencil_calcHist, single-threaded.
+inline void calc_hist_banked( const int rows, const int cols, const int step, const uint8_t image[], int hist[HISTOGRAM_BINS] )
+{
+    std::fill( hist, hist + HISTOGRAM_BINS, 0 );
+    hist::count_rows( 0, rows, cols, step, image, hist );
+}
+
+struct sampled_hist_info {
+    long long samples;      // pixels counted
+    long long population;   // pixels of the image
+    double scale;           // population / samples, the weight of a counted pixel
+    double max_std_error;   // largest standard error of a bin, in pixels
+};
+
+// Estimates the histogram of pencil_calcHist from about rate * rows * cols pixels.
+// Only one row per band of 1 / rate pixels is read, so the cost falls with the rate.
+// The counts are scaled to the whole image; the standard error of bin b is
+//     scale * sqrt( n * p_b * (1 - p_b) * (1 - n / N) ),   p_b = count_b / n,
+// i.e. sampling without replacement of n out of N pixels. It is written to std_error
+// if that is not null. SAMPLE_STRIDE is cheaper; SAMPLE_JITTERED does not alias with
+// periodic patterns, which the estimate assumes. A rate of 1 gives the exact histogram.
+inline sampled_hist_info calc_hist_sampled( const int rows, const int cols, const int step, const uint8_t image[]
+                                          , const double rate, const hist::sampling_t mode
+                                          , int hist[HISTOGRAM_BINS], double std_error[HISTOGRAM_BINS] = nullptr
+                                          )
+{
+    int row_step, col_step;
+    hist::sampling_grid( rate, row_step, col_step );
+
+    uint32_t banks[hist::HIST_BANKS][HISTOGRAM_BINS];
+    std::memset( banks, 0, sizeof(banks) );
+    uint32_t state = 0x9E3779B9u;
+    long long samples = 0;
+
+    if ( row_step == 1 && col_step == 1 ) {
+        // every pixel is sampled, count them as the exact histogram does
+        int exact[HISTOGRAM_BINS];
+        calc_hist_banked( rows, cols, step, image, exact );
+        std::copy( exact, exact + HISTOGRAM_BINS, banks[0] );
+        samples = static_cast<long long>(rows) * cols;
+    } else {
+        for ( int r0 = 0; r0 < rows; r0 += row_step ) {
+            const int r = mode == hist::SAMPLE_STRIDE ? r0 : r0 + hist::random_below( state, std::min( row_step, rows - r0 ) );
+            const uint8_t * row = image + std::size_t(r) * step;
+            // one column per cell, the last cell of the row may be narrower
+            const int full_cells = cols / col_step;
+            int cell = 0;
+            if ( mode == hist::SAMPLE_STRIDE ) {
+                // 4 cells at a time, cell k of the 4 into bank k % HIST_BANKS
+                for ( ; cell + 4 <= full_cells; cell += 4 ) {
+                    const uint8_t * p = row + std::size_t(cell) * col_step;
+                    ++banks[0 % hist::HIST_BANKS][p[0]];
+                    ++banks[1 % hist::HIST_BANKS][p[col_step]];
+                    ++banks[2 % hist::HIST_BANKS][p[2 * col_step]];
+                    ++banks[3 % hist::HIST_BANKS][p[3 * col_step]];
+                }
+                for ( ; cell * col_step < cols; ++cell )
+                    ++banks[cell % hist::HIST_BANKS][row[cell * col_step]];
+            } else {
+                for ( ; cell < full_cells; ++cell )
+                    ++banks[cell % hist::HIST_BANKS][row[cell * col_step + hist::random_below( state, col_step )]];
+                for ( ; cell * col_step < cols; ++cell )
+                    ++banks[cell % hist::HIST_BANKS][row[cell * col_step + hist::random_below( state, cols - cell * col_step )]];
+            }
+            samples += cell;
+        }
+    }
+
+    sampled_hist_info info;
+    info.samples = samples;
+    info.population = static_cast<long long>(rows) * cols;
+    info.scale = samples > 0 ? double(info.population) / samples : 0.0;
+    info.max_std_error = 0.0;
+    const double correction = samples > 0 ? 1.0 - double(samples) / info.population : 0.0;
+    for ( int b = 0; b < HISTOGRAM_BINS; ++b ) {
+        uint32_t count = 0;
+        for ( int k = 0; k < hist::HIST_BANKS; ++k )
+            count += banks[k][b];
+        hist[b] = static_cast<int>( std::floor( count * info.scale + 0.5 ) );
+        const double p = samples > 0 ? double(count) / samples : 0.0;
+        const double error = info.scale * std::sqrt( samples * p * (1.0 - p) * correction );
+        info.max_std_error = std::max( info.max_std_error, error );
+        if ( std_error )
+            std_error[b] = error;
+    }
+    return info;
+}
+
+// Same interface and result as pencil_calcHist. Without TBB the rows are counted serially.
+inline void calc_hist_parallel( const int rows, const int cols, const int step, const uint8_t image[], int hist[HISTOGRAM_BINS] )
+{
+#ifdef WITH_TBB
+    hist::partial result( cols, step, image );
+    tbb::parallel_reduce( tbb::blocked_range<int>(0, rows, hist::ROW_GRAIN), result );
+    std::copy( result.hist, result.hist + HISTOGRAM_BINS, hist );
+#else
+    calc_hist_banked( rows, cols, step, image, hist );
+#endif
+}
+
+} // namespace carp
+
+#endif // CALC_HIST_HPP
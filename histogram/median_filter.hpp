@@ -0,0 +1,152 @@
+// Median and percentile filters with a per-pixel cost that does not depend on the radius
+//
+// The histogram of the (2 radius + 1) x (2 radius + 1) window is maintained as in
+// Perreault and Hebert, "Median Filtering in Constant Time": every image column has
+// a histogram of its 2 radius + 1 pixels in the window rows, which moves down one row
+// by removing one pixel and adding one. The window histogram is the sum of 2 radius + 1
+// column histograms and moves right by adding one column histogram and removing
+// another, i.e. HISTOGRAM_BINS additions and subtractions whatever the radius.
+// A coarse level of HIST_COARSE_BINS counts makes the rank search two short scans.
+// Borders are replicated, as in cv::medianBlur.
+
+#ifndef MEDIAN_FILTER_HPP
+#define MEDIAN_FILTER_HPP
+
+#include "histogram.pencil.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace carp {
+
+namespace hist {
+
+    enum {
+        HIST_COARSE_BINS  = 16,
+        HIST_COARSE_SHIFT = 4,      // HISTOGRAM_BINS / HIST_COARSE_BINS == 1 << HIST_COARSE_SHIFT
+    };
+
+    class sliding_window {
+        const int rows, cols, step, radius;
+        const uint8_t * const image;
+        std::vector<uint16_t> column;           // cols x HISTOGRAM_BINS
+        std::vector<uint16_t> column_coarse;    // cols x HIST_COARSE_BINS
+        uint32_t window[HISTOGRAM_BINS];
+        uint32_t window_coarse[HIST_COARSE_BINS];
+        int x, y;
+
+        int clamp_row( const int r ) const { return std::min( std::max( r, 0 ), rows - 1 ); }
+        int clamp_col( const int c ) const { return std::min( std::max( c, 0 ), cols - 1 ); }
+
+        void update_columns( const int r, const int delta ) {
+            const uint8_t * row = image + std::size_t(r) * step;
+            for ( int c = 0; c < cols; ++c ) {
+                column[std::size_t(c) * HISTOGRAM_BINS + row[c]] += delta;
+                column_coarse[std::size_t(c) * HIST_COARSE_BINS + (row[c] >> HIST_COARSE_SHIFT)] += delta;
+            }
+        }
+
+        void add_column( const int c ) {
+            const uint16_t * fine = &column[std::size_t(c) * HISTOGRAM_BINS];
+            const uint16_t * coarse = &column_coarse[std::size_t(c) * HIST_COARSE_BINS];
+            for ( int b = 0; b < HISTOGRAM_BINS; ++b )
+                window[b] += fine[b];
+            for ( int b = 0; b < HIST_COARSE_BINS; ++b )
+                window_coarse[b] += coarse[b];
+        }
+
+        void sub_column( const int c ) {
+            const uint16_t * fine = &column[std::size_t(c) * HISTOGRAM_BINS];
+            const uint16_t * coarse = &column_coarse[std::size_t(c) * HIST_COARSE_BINS];
+            for ( int b = 0; b < HISTOGRAM_BINS; ++b )
+                window[b] -= fine[b];
+            for ( int b = 0; b < HIST_COARSE_BINS; ++b )
+                window_coarse[b] -= coarse[b];
+        }
+
+    public:
+        sliding_window( const int rows_, const int cols_, const int step_, const uint8_t image_[], const int radius_ )
+            : rows(rows_), cols(cols_), step(step_), radius(radius_), image(image_)
+            , column( std::size_t(cols_) * HISTOGRAM_BINS, 0 )
+            , column_coarse( std::size_t(cols_) * HIST_COARSE_BINS, 0 )
+            , x(0), y(-1)
+        {
+            if ( radius < 0 || 2 * radius + 1 > 0xFFFF )
+                throw std::runtime_error("The radius of the sliding window is out of range.");
+            for ( int r = -radius; r <= radius; ++r )
+                update_columns( clamp_row(r), 1 );
+        }
+
+        int size() const {
+            return (2 * radius + 1) * (2 * radius + 1);
+        }
+
+        // Places the window at the first pixel of the next row.
+        void next_row() {
+            if ( y >= 0 ) {
+                const int removed = clamp_row( y - radius );
+                const int added = clamp_row( y + radius + 1 );
+                if ( removed != added ) {
+                    update_columns( removed, -1 );
+                    update_columns( added, 1 );
+                }
+            }
+            ++y;
+            x = 0;
+            std::fill( window, window + HISTOGRAM_BINS, 0 );
+            std::fill( window_coarse, window_coarse + HIST_COARSE_BINS, 0 );
+            for ( int c = -radius; c <= radius; ++c )
+                add_column( clamp_col(c) );
+        }
+
+        // Moves the window one pixel to the right.
+        void next_col() {
+            add_column( clamp_col( x + radius + 1 ) );
+            sub_column( clamp_col( x - radius ) );
+            ++x;
+        }
+
+        // The value at position k (0 based) of the sorted window.
+        int rank( int k ) const {
+            int coarse = 0;
+            while ( k >= int(window_coarse[coarse]) )
+                k -= window_coarse[coarse++];
+            int b = coarse << HIST_COARSE_SHIFT;
+            while ( k >= int(window[b]) )
+                k -= window[b++];
+            return b;
+        }
+    };
+}
+
+// Replaces every pixel with the given percentile (0: minimum, 0.5: median, 1: maximum)
+// of its (2 radius + 1) x (2 radius + 1) neighbourhood.
+inline void percentile_filter( const int rows, const int cols, const int src_step, const uint8_t src[], const int dst_step, uint8_t dst[], const int radius, const double percentile )
+{
+    hist::sliding_window window( rows, cols, src_step, src, radius );
+    const double clamped = std::min( std::max( percentile, 0.0 ), 1.0 );
+    const int k = static_cast<int>( std::floor( clamped * (window.size() - 1) + 0.5 ) );
+    for ( int r = 0; r < rows; ++r ) {
+        window.next_row();
+        uint8_t * row = dst + std::size_t(r) * dst_step;
+        for ( int c = 0; c < cols; ++c ) {
+            if ( c > 0 )
+                window.next_col();
+            row[c] = static_cast<uint8_t>( window.rank(k) );
+        }
+    }
+}
+
+// Same result as cv::medianBlur with ksize = 2 radius + 1.
+inline void median_filter( const int rows, const int cols, const int src_step, const uint8_t src[], const int dst_step, uint8_t dst[], const int radius )
+{
+    percentile_filter( rows, cols, src_step, src, dst_step, dst, radius, 0.5 );
+}
+
+} // namespace carp
+
+#endif // MEDIAN_FILTER_HPP
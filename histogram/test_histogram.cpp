@@ -1,11 +1,61 @@
 #include "utility.hpp"
 #include "histogram.pencil.h"
+#include "calc_hist.hpp"
+#include "median_filter.hpp"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/ocl/ocl.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
 #include <prl.h>
 #include <chrono>
+#include <thread>
+#include <sstream>
+
+#ifdef WITH_TBB
+#include <tbb/task_arena.h>
+#endif
+
+namespace
+{
+    cv::Mat reference_histogram( const cv::Mat & gray )
+    {
+        cv::Mat hist, result;
+        const int channels = 0;
+        const int histSize = HISTOGRAM_BINS;
+        const float range[] = {0, 256};
+        const float* ranges[] = {range};
+        cv::calcHist( &gray, 1, &channels, cv::Mat(), hist, 1, &histSize, ranges );
+        hist = hist.t();
+        hist.convertTo( result, CV_32S );
+        return result;
+    }
+
+    // cv::calcHist of the channels of image with uniform ranges, as a row major CV_32S matrix
+    cv::Mat reference_histogram( const cv::Mat & image, const std::vector<int> & channels, const std::vector<int> & sizes, const std::vector<float> & bounds )
+    {
+        std::vector<const float*> ranges;
+        for ( size_t i = 0; i < channels.size(); ++i )
+            ranges.push_back( &bounds[2 * i] );
+        cv::Mat hist, result;
+        cv::calcHist( &image, 1, channels.data(), cv::Mat(), hist, int(channels.size()), sizes.data(), ranges.data() );
+        hist.reshape( 1, 1 ).convertTo( result, CV_32S );
+        return result;
+    }
+
+    // runs f with at most num_threads worker threads
+    template <typename F>
+    void with_threads( const int num_threads, const F & f )
+    {
+#ifdef WITH_TBB
+        tbb::task_arena arena( num_threads );
+        arena.execute( f );
+#else
+        (void)num_threads;
+        f();
+#endif
+    }
+}
 
 void time_histogram( const std::vector<carp::record_t>& pool, size_t iterations)
 {
@@ -14,9 +64,11 @@ void time_histogram( const std::vector<carp::record_t>& pool, size_t iterations)
     carp::Timing timing("histogram");
     for ( auto & item : pool ) {
         for(size_t i = 0; i < iterations; ++i) {
-            cv::Mat cpuimg;
-
-            cv::cvtColor( item.cpuimg(), cpuimg, CV_RGB2GRAY );
+            // decoding straight to grayscale, the decoder skips the color conversion
+            const auto decode_start = std::chrono::high_resolution_clock::now();
+            cv::Mat cpuimg = item.grayimg();
+            const auto decode_end = std::chrono::high_resolution_clock::now();
+            timing.print( "decode (gray)", decode_end - decode_start );
 
             cv::Mat cpu_result, gpu_result, pen_result;
 
@@ -87,6 +139,240 @@ void time_histogram( const std::vector<carp::record_t>& pool, size_t iterations)
     }
 }
 
+void time_histogram_banked( const std::vector<carp::record_t>& pool, size_t iterations )
+{
+    carp::Timing timing("single-thread multi-bank histogram");
+    for ( auto & item : pool ) {
+        cv::Mat gray = item.grayimg();
+        // a flat image is the worst case of one histogram: every increment depends on the previous one
+        const cv::Mat flat( gray.size(), CV_8U, cv::Scalar(128) );
+        const cv::Mat * images[] = { &gray, &flat };
+        const char * names[] = { "image", "flat" };
+
+        for(size_t i = 0; i < iterations; ++i) {
+            for ( int k = 0; k < 2; ++k ) {
+                const cv::Mat & cpuimg = *images[k];
+                cv::Mat cpu_result, bank_result( 1, HISTOGRAM_BINS, CV_32S );
+
+                const auto cpu_start = std::chrono::high_resolution_clock::now();
+                cpu_result = reference_histogram( cpuimg );
+                const auto cpu_end = std::chrono::high_resolution_clock::now();
+
+                const auto bank_start = std::chrono::high_resolution_clock::now();
+                carp::calc_hist_banked( cpuimg.rows, cpuimg.cols, cpuimg.step1(), cpuimg.ptr<uint8_t>(), bank_result.ptr<int>() );
+                const auto bank_end = std::chrono::high_resolution_clock::now();
+
+                if ( cv::norm( bank_result, cpu_result, cv::NORM_INF ) != 0 )
+                    throw std::runtime_error("The multi-bank histogram is not equivalent with the CPU results.");
+
+                timing.print( std::string("cv::calcHist (") + names[k] + ")", cpu_end - cpu_start );
+                timing.print( std::string("multi-bank histogram (") + names[k] + ")", bank_end - bank_start );
+            }
+        }
+    }
+}
+
+void time_histogram_scaling( const std::vector<carp::record_t>& pool, size_t iterations )
+{
+    carp::Timing timing("parallel histogram");
+
+    std::vector<int> thread_counts;
+#ifdef WITH_TBB
+    const int max_threads = std::max( 1u, std::thread::hardware_concurrency() );
+    for ( int n = 1; n < max_threads; n *= 2 )
+        thread_counts.push_back(n);
+#else
+    const int max_threads = 1;
+#endif
+    thread_counts.push_back(max_threads);
+    std::vector<double> accumulated( thread_counts.size(), 0.0 );
+
+    for ( auto & item : pool ) {
+        cv::Mat cpuimg = item.grayimg();
+        const cv::Mat cpu_result = reference_histogram( cpuimg );
+
+        for(size_t i = 0; i < iterations; ++i) {
+            for ( size_t t = 0; t < thread_counts.size(); ++t ) {
+                cv::Mat par_result( cpu_result.rows, cpu_result.cols, CV_32S );
+
+                const auto start = std::chrono::high_resolution_clock::now();
+                with_threads( thread_counts[t], [&]() {
+                    carp::calc_hist_parallel( cpuimg.rows, cpuimg.cols, cpuimg.step1(), cpuimg.ptr<uint8_t>(), par_result.ptr<int>() );
+                } );
+                const auto end = std::chrono::high_resolution_clock::now();
+
+                if ( cv::norm( par_result, cpu_result, cv::NORM_INF ) != 0 )
+                    throw std::runtime_error("The parallel histogram is not equivalent with the CPU results.");
+
+                std::ostringstream name;
+                name << "parallel histogram (" << thread_counts[t] << " threads)";
+                const std::chrono::duration<double,std::milli> elapsed = end - start;
+                timing.print( name.str(), elapsed );
+                accumulated[t] += elapsed.count();
+            }
+        }
+    }
+
+    std::cout << std::endl << "Parallel histogram scaling (speedup over 1 thread):" << std::endl;
+    for ( size_t t = 0; t < thread_counts.size(); ++t )
+        std::cout << std::setw(4) << thread_counts[t] << " threads: " << accumulated[0] / accumulated[t] << std::endl;
+}
+
+void time_histogram_sampled( const std::vector<carp::record_t>& pool, size_t iterations )
+{
+    carp::Timing timing("sampled histogram");
+    const int denominators[] = { 1, 4, 16, 64, 256 };
+    const carp::hist::sampling_t modes[] = { carp::hist::SAMPLE_STRIDE, carp::hist::SAMPLE_JITTERED };
+    const char * mode_names[] = { "stride", "jittered" };
+
+    for ( auto & item : pool ) {
+        cv::Mat cpuimg = item.grayimg();
+        const double pixels = double(cpuimg.rows) * cpuimg.cols;
+
+        for(size_t i = 0; i < iterations; ++i) {
+            cv::Mat exact_result( 1, HISTOGRAM_BINS, CV_32S );
+            const auto exact_start = std::chrono::high_resolution_clock::now();
+            carp::calc_hist_banked( cpuimg.rows, cpuimg.cols, cpuimg.step1(), cpuimg.ptr<uint8_t>(), exact_result.ptr<int>() );
+            const auto exact_end = std::chrono::high_resolution_clock::now();
+            const std::chrono::duration<double,std::milli> exact_time = exact_end - exact_start;
+            timing.print( "exact histogram", exact_time );
+
+            for ( int m = 0; m < 2; ++m ) {
+                for ( auto & denominator : denominators ) {
+                    cv::Mat sampled_result( 1, HISTOGRAM_BINS, CV_32S );
+                    double std_error[HISTOGRAM_BINS];
+
+                    const auto start = std::chrono::high_resolution_clock::now();
+                    const carp::sampled_hist_info info = carp::calc_hist_sampled( cpuimg.rows, cpuimg.cols, cpuimg.step1(), cpuimg.ptr<uint8_t>()
+                                                                                , 1.0 / denominator, modes[m], sampled_result.ptr<int>(), std_error
+                                                                                );
+                    const auto end = std::chrono::high_resolution_clock::now();
+                    const std::chrono::duration<double,std::milli> elapsed = end - start;
+
+                    if ( denominator == 1 && cv::norm( sampled_result, exact_result, cv::NORM_INF ) != 0 )
+                        throw std::runtime_error("The fully sampled histogram is not equivalent with the exact histogram.");
+
+                    // accuracy, relative to the number of pixels
+                    double max_error = 0.0;
+                    int within_3_sigma = 0;
+                    for ( int b = 0; b < HISTOGRAM_BINS; ++b ) {
+                        const double error = std::abs( sampled_result.at<int>(b) - exact_result.at<int>(b) );
+                        max_error = std::max( max_error, error );
+                        within_3_sigma += error <= 3.0 * std_error[b] + info.scale;
+                    }
+
+                    std::ostringstream name;
+                    name << "sampled histogram (" << mode_names[m] << ", 1/" << denominator << ")";
+                    timing.print( name.str(), elapsed );
+                    std::cout << "    speedup " << exact_time.count() / elapsed.count()
+                              << ", " << info.samples << " samples"
+                              << ", max bin error " << 100.0 * max_error / pixels << "%"
+                              << " (estimated sigma " << 100.0 * info.max_std_error / pixels << "%)"
+                              << ", " << within_3_sigma << "/" << HISTOGRAM_BINS << " bins within 3 sigma" << std::endl;
+                }
+            }
+        }
+    }
+}
+
+template <typename Bins>
+void time_uniform_bins( carp::Timing & timing, const cv::Mat & cpuimg, const int low, const int high, const char * name )
+{
+    cv::Mat cpu_result, bin_result( 1, Bins::bins, CV_32S );
+
+    const auto cpu_start = std::chrono::high_resolution_clock::now();
+    cpu_result = reference_histogram( cpuimg, { 0 }, { Bins::bins }, { float(low), float(high) } );
+    const auto cpu_end = std::chrono::high_resolution_clock::now();
+
+    const auto bin_start = std::chrono::high_resolution_clock::now();
+    carp::calc_hist_uniform<Bins>( cpuimg.rows, cpuimg.cols, cpuimg.step1(), cpuimg.ptr<uint8_t>(), bin_result.ptr<int>() );
+    const auto bin_end = std::chrono::high_resolution_clock::now();
+
+    if ( cv::norm( bin_result, cpu_result, cv::NORM_INF ) != 0 )
+        throw std::runtime_error("The histogram with compile-time bins is not equivalent with the CPU results.");
+
+    timing.print( std::string("cv::calcHist (") + name + ")", cpu_end - cpu_start );
+    timing.print( std::string("compile-time bins (") + name + ")", bin_end - bin_start );
+}
+
+void time_histogram_bins( const std::vector<carp::record_t>& pool, size_t iterations )
+{
+    carp::Timing timing("histogram with compile-time bins");
+    for ( auto & item : pool ) {
+        const cv::Mat gray = item.grayimg();
+        cv::Mat hsv;
+        cv::cvtColor( item.cpuimg(), hsv, CV_BGR2HSV );
+
+        for(size_t i = 0; i < iterations; ++i) {
+            time_uniform_bins< carp::hist::uniform_bins<32> >( timing, gray, 0, 256, "32 bins" );
+            time_uniform_bins< carp::hist::uniform_bins<64, 0, 192> >( timing, gray, 0, 192, "64 bins over [0, 192)" );
+
+            // hue and saturation, counted together from the interleaved HSV pixels
+            typedef carp::hist::uniform_bins<30, 0, 180> hue_bins;
+            typedef carp::hist::uniform_bins<32> saturation_bins;
+            cv::Mat cpu_result, joint_result( 1, hue_bins::bins * saturation_bins::bins, CV_32S );
+
+            const auto cpu_start = std::chrono::high_resolution_clock::now();
+            cpu_result = reference_histogram( hsv, { 0, 1 }, { hue_bins::bins, saturation_bins::bins }, { 0, 180, 0, 256 } );
+            const auto cpu_end = std::chrono::high_resolution_clock::now();
+
+            const auto joint_start = std::chrono::high_resolution_clock::now();
+            carp::calc_hist_joint<hue_bins, saturation_bins>( hsv.rows, hsv.cols, hsv.step1(), hsv.channels(), hsv.ptr<uint8_t>(), 0, 1, joint_result.ptr<int>() );
+            const auto joint_end = std::chrono::high_resolution_clock::now();
+
+            if ( cv::norm( joint_result, cpu_result, cv::NORM_INF ) != 0 )
+                throw std::runtime_error("The joint hue-saturation histogram is not equivalent with the CPU results.");
+
+            timing.print( "cv::calcHist (hue x saturation)", cpu_end - cpu_start );
+            timing.print( "joint histogram (hue x saturation)", joint_end - joint_start );
+        }
+    }
+}
+
+void time_median( const std::vector<carp::record_t>& pool, const std::vector<int>& radii, size_t iterations )
+{
+    carp::Timing timing("median filter");
+    for ( auto & item : pool ) {
+        cv::Mat gray = item.grayimg();
+        for ( auto & radius : radii ) {
+            const int ksize = 2 * radius + 1;
+            for(size_t i = 0; i < iterations; ++i) {
+                cv::Mat cpu_result, hist_result( gray.size(), CV_8U );
+
+                const auto cpu_start = std::chrono::high_resolution_clock::now();
+                cv::medianBlur( gray, cpu_result, ksize );
+                const auto cpu_end = std::chrono::high_resolution_clock::now();
+
+                const auto hist_start = std::chrono::high_resolution_clock::now();
+                carp::median_filter( gray.rows, gray.cols, gray.step1(), gray.ptr<uint8_t>(), hist_result.step1(), hist_result.ptr<uint8_t>(), radius );
+                const auto hist_end = std::chrono::high_resolution_clock::now();
+
+                if ( cv::norm( hist_result, cpu_result, cv::NORM_INF ) != 0 ) {
+                    cv::imwrite( "cpu_median.png", cpu_result );
+                    cv::imwrite( "hist_median.png", hist_result );
+                    throw std::runtime_error("The sliding-window median is not equivalent with the CPU results.");
+                }
+
+                std::ostringstream name;
+                name << " (ksize " << ksize << ")";
+                timing.print( "cv::medianBlur" + name.str(), cpu_end - cpu_start );
+                timing.print( "sliding-window median" + name.str(), hist_end - hist_start );
+            }
+            {
+                // the extreme percentiles are a rectangular erosion and dilation
+                const cv::Mat element = cv::getStructuringElement( cv::MORPH_RECT, cv::Size( ksize, ksize ) );
+                cv::Mat eroded, dilated, min_result( gray.size(), CV_8U ), max_result( gray.size(), CV_8U );
+                cv::erode( gray, eroded, element );
+                cv::dilate( gray, dilated, element );
+                carp::percentile_filter( gray.rows, gray.cols, gray.step1(), gray.ptr<uint8_t>(), min_result.step1(), min_result.ptr<uint8_t>(), radius, 0.0 );
+                carp::percentile_filter( gray.rows, gray.cols, gray.step1(), gray.ptr<uint8_t>(), max_result.step1(), max_result.ptr<uint8_t>(), radius, 1.0 );
+                if ( cv::norm( min_result, eroded, cv::NORM_INF ) != 0 || cv::norm( max_result, dilated, cv::NORM_INF ) != 0 )
+                    throw std::runtime_error("The sliding-window percentiles are not equivalent with the CPU results.");
+            }
+        }
+    }
+}
+
 int main(int argc, char* argv[])
 {
     prl_init((prl_init_flags)(PRL_TARGET_DEVICE_DYNAMIC | PRL_PROFILING_ENABLED));
@@ -103,6 +389,14 @@ int main(int argc, char* argv[])
 #endif
 
     time_histogram( pool, num_iterations );
+#ifndef RUN_ONLY_ONE_EXPERIMENT
+    //The tuning runs only time the histogram of time_histogram
+    time_histogram_banked( pool, num_iterations );
+    time_histogram_scaling( pool, num_iterations );
+    time_histogram_sampled( pool, num_iterations );
+    time_histogram_bins( pool, num_iterations );
+    time_median( pool, { 3, 15, 25, 50 }, 1 );
+#endif
 
     prl_shutdown();
     return EXIT_SUCCESS;
@@ -15,6 +15,9 @@
 
 #include <opencv2/core/core.hpp>
 
+#include "hog_lookup.hpp"
+#include "hog_quantize.hpp"
+
 #define NOMINMAX
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
@@ -23,31 +26,139 @@
 #include <chrono>
 
 namespace nel {
+    class HOGIntegralHistogram;
+
+    // Block normalization, applied by every backend to each descriptor as it is computed.
+    // The values are passed as is to pencil_hog and to the OpenCL kernels.
+    enum HOGNormalization {
+        NORMALIZE_NONE   = 0,
+        NORMALIZE_L2     = 1,   // v / ||v||_2
+        NORMALIZE_L2HYS  = 2,   // L2, clipped at L2HYS_THRESHOLD, L2 again
+        NORMALIZE_L1SQRT = 3,   // sqrt(v / ||v||_1)
+    };
+
+    const float L2HYS_THRESHOLD = 0.2f;
+
     class HOGDescriptorCPP {
     public:
-        HOGDescriptorCPP(int numberOfCells, int numberOfBins, bool gauss, bool spinterp, bool _signed);
+        enum GradientMode {
+            GRADIENTS_AUTO,         // shared when the blocks add up to more pixels than the image
+            GRADIENTS_PER_PIXEL,    // every location computes the gradients of its own pixels
+            GRADIENTS_SHARED,       // the gradients of the union of the blocks are computed once (HOGGradientTiles)
+            GRADIENTS_INTEGRAL,     // one integral image per bin (HOGIntegralHistogram), needs !gauss && !spinterp
+        };
+
+        // vectorized: histograms of 8 pixels at a time (nel::simd::accumulate_block) when HOG_SIMD is available
+        // specialized: code compiled for the cells, bins and flags of the common configurations
+        // ordered: the locations are processed in the Morton order of their footprints, the descriptors are in the input order
+        HOGDescriptorCPP( int numberOfCells, int numberOfBins, bool gauss, bool spinterp, bool _signed
+                        , HOGNormalization normalization = NORMALIZE_NONE, bool vectorized = true, bool specialized = true
+                        , bool ordered = true
+                        );
         cv::Mat_<float> compute( const cv::Mat_<uint8_t> &img
                                , const cv::Mat_<float>   &locations
                                , const cv::Mat_<float>   &blocksizes
+                               , GradientMode             mode = GRADIENTS_AUTO
                                ) const;
+        // compute() with the descriptors written in the given format (hog_quantize.hpp); OUTPUT_UINT8 needs a normalization
+        cv::Mat computeAs( const cv::Mat_<uint8_t> &img
+                         , const cv::Mat_<float>   &locations
+                         , const cv::Mat_<float>   &blocksizes
+                         , HOGOutputFormat          format
+                         , GradientMode             mode = GRADIENTS_AUTO
+                         ) const;
+
+        // Dense grid: cells of cellsize pixels tile [1, cols - 2] x [1, rows - 2] from its top left corner and a block of
+        // numberOfCells x numberOfCells cells starts at every cell with room for it. Every cell histogram is computed once
+        // and shared by the blocks that contain it. Needs !gauss && !spinterp.
+        cv::Size denseBlocks(const cv::Size &imagesize, const cv::Size &cellsize) const;
+        // The locations and block sizes of compute() for the dense blocks, in row-major order
+        void denseLocations(const cv::Size &imagesize, const cv::Size &cellsize, cv::Mat_<float> &locations, cv::Mat_<float> &blocksizes) const;
+        // The dense block descriptors, one row per block in row-major order
+        cv::Mat_<float> computeDense(const cv::Mat_<uint8_t> &img, const cv::Size &cellsize) const;
+        // Linear classifier on the windows of window.width x window.height dense blocks, one window per block with room for it:
+        // score(y, x) = bias + sum of <block(y + by, x + bx), weights of (by, bx)>, weights holding the window.area() block
+        // weights in row-major order. The blocks are read from the shared cells, the window descriptors are never stored.
+        cv::Mat_<float> detectDense( const cv::Mat_<uint8_t> &img
+                                   , const cv::Size          &cellsize
+                                   , const cv::Size          &window
+                                   , const cv::Mat_<float>   &weights
+                                   , float                    bias
+                                   ) const;
+
+        // compute() on every level of an image pyramid: levels[i] = compute(img scaled by scales[i], locations[i], blocksizes[i], mode),
+        // the levels running in parallel (nel::for_each_pyramid_level)
+        std::vector<cv::Mat_<float> > computePyramid( const cv::Mat_<uint8_t>              &img
+                                                    , const std::vector<float>             &scales
+                                                    , const std::vector<cv::Mat_<float> >  &locations
+                                                    , const std::vector<cv::Mat_<float> >  &blocksizes
+                                                    , GradientMode                          mode = GRADIENTS_AUTO
+                                                    ) const;
 
         int getNumberOfBins() const;
 
     private:
-        float get_orientation(float mdy, float mdx) const;
+        // Throws if the dense grid is not defined for this descriptor or cellsize
+        void checkDenseGrid(const cv::Size &cellsize) const;
+        // The cell histograms of the dense grid, cells(celly, cellx * numberOfBins + bin)
+        void computeCells(const cv::Mat_<uint8_t> &img, const cv::Size &cellsize, cv::Mat_<float> &cells) const;
+
+        template <typename Gradients>
+        void computeLocations( const Gradients         &gradients
+                             , const cv::Mat_<uint8_t> &img
+                             , const cv::Mat_<float>   &locations
+                             , const cv::Mat_<float>   &blocksizes
+                             , const std::vector<int>  &order
+                             , cv::Mat                 &descriptors
+                             , HOGOutputFormat         format
+                             ) const;
+
+        template <int Cells, int Bins, typename Gradients>
+        bool computeSpecialized( const Gradients         &gradients
+                               , const cv::Mat_<uint8_t> &img
+                               , const cv::Mat_<float>   &locations
+                               , const cv::Mat_<float>   &blocksizes
+                               , const std::vector<int>  &order
+                               , cv::Mat                 &descriptors
+                               , HOGOutputFormat         format
+                               ) const;
+
+        template <typename Config, typename Gradients>
+        void computeLocations( const Config            &config
+                             , const Gradients         &gradients
+                             , const cv::Mat_<uint8_t> &img
+                             , const cv::Mat_<float>   &locations
+                             , const cv::Mat_<float>   &blocksizes
+                             , const std::vector<int>  &order
+                             , cv::Mat                 &descriptors
+                             , HOGOutputFormat         format
+                             ) const;
+
+        void computeIntegral( const HOGIntegralHistogram  &histograms
+                            , const std::vector<cv::Rect> &footprints
+                            , const cv::Mat_<float>       &locations
+                            , const cv::Mat_<float>       &blocksizes
+                            , const std::vector<int>      &order
+                            , cv::Mat                     &descriptors
+                            , HOGOutputFormat             format
+                            ) const;
 
     private:
-        std::vector<std::pair<float, float> > m_lookupTable;
+        HOGGradientLookup m_lookupTable;
         int numberOfCells;
         int numberOfBins;
         bool gauss;
         bool spinterp;
         bool _signed;
+        HOGNormalization normalization;
+        bool vectorized;
+        bool specialized;
+        bool ordered;
     };
 
 	class HOGDescriptorOCL {
     public:
-        HOGDescriptorOCL(int numberOfCells, int numberOfBins, bool gauss, bool spinterp, bool _signed);
+        HOGDescriptorOCL(int numberOfCells, int numberOfBins, bool gauss, bool spinterp, bool _signed, HOGNormalization normalization = NORMALIZE_NONE);
 
         cv::Mat_<float> compute( const cv::Mat_<uint8_t>       &img
                                , const cv::Mat_<float>         &locations
@@ -61,6 +172,8 @@ namespace nel {
     private:
         int numberOfCells;
         int numberOfBins;
+        bool gauss;
+        HOGNormalization normalization;
 
         cl::Device device;
         cl::Context context;
@@ -71,6 +184,9 @@ namespace nel {
         size_t calc_hog_preferred_multiple;
         size_t calc_hog_group_size;
 
+        mutable cl::Kernel normalize_hog;
+        size_t normalize_hog_preferred_multiple;
+
 #ifndef CL_VERSION_1_2
         mutable cl::Kernel fill_zeros;
         size_t fill_zeros_preferred_multiple;
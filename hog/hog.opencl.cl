@@ -13,6 +13,15 @@
 #ifndef SIGNED_HOG
 #error SIGNED_HOG not defined
 #endif
+#ifndef NORMALIZATION
+#error NORMALIZATION not defined
+#endif
+
+//Values of nel::HOGNormalization
+#define NORMALIZE_NONE   0
+#define NORMALIZE_L2     1
+#define NORMALIZE_L2HYS  2
+#define NORMALIZE_L1SQRT 3
 
 #define TOTAL_NUMBER_OF_BINS (NUMBER_OF_CELLS * NUMBER_OF_CELLS * NUMBER_OF_BINS)
 
@@ -59,6 +68,9 @@ __kernel void calc_hog( const int rows, const int cols, const int step_, __globa
                       , __global float hist_global[][NUMBER_OF_CELLS][NUMBER_OF_CELLS][NUMBER_OF_BINS]
 #ifndef DISABLE_LOCAL
                       ,  __local float  hist_local[][NUMBER_OF_CELLS][NUMBER_OF_CELLS][NUMBER_OF_BINS]
+#if GAUSSIAN_WEIGHTS
+                      ,  __local float  weight_local[]
+#endif
 #endif
                       )
 {
@@ -79,7 +91,25 @@ __kernel void calc_hog( const int rows, const int cols, const int step_, __globa
             }
         }
     }
-    
+
+#if GAUSSIAN_WEIGHTS
+    //exp(dot(distanceSq, m1p2sigmaSq)) = exp(distanceSq.x * m1p2sigmaSq.x) * exp(distanceSq.y * m1p2sigmaSq.y):
+    //the first row of the work group computes the column weights, the first column the row weights
+    __local float *weight_local_x = weight_local + location_local_idx * (get_local_size(0) + get_local_size(1));
+    __local float *weight_local_y = weight_local_x + get_local_size(0);
+    if (location_global_idx < num_locations) {
+        float2 location = location_global[location_global_idx];
+        float2 blck_size = blocksize_global[location_global_idx];
+        float2 m1p2sigmaSq = -2.0f / (blck_size * blck_size);
+        int2 mini = max(convert_int2_rtp(location - blck_size * 0.5f), 1);
+        float2 distance = convert_float2(mini + (int2)(get_global_id(0),get_global_id(1))) - location;
+        if (get_local_id(1) == 0)
+            weight_local_x[get_local_id(0)] = exp(distance.x * distance.x * m1p2sigmaSq.x);
+        if (get_local_id(0) == 0)
+            weight_local_y[get_local_id(1)] = exp(distance.y * distance.y * m1p2sigmaSq.y);
+    }
+#endif
+
     barrier(CLK_LOCAL_MEM_FENCE);
 #endif
     
@@ -111,7 +141,9 @@ __kernel void calc_hog( const int rows, const int cols, const int step_, __globa
             float orientation = atan2pi(mdy, mdx) + 0.5f;
 #endif
 
-#if GAUSSIAN_WEIGHTS
+#if GAUSSIAN_WEIGHTS && !defined(DISABLE_LOCAL)
+            magnitude *= weight_local_y[get_local_id(1)] * weight_local_x[get_local_id(0)];
+#elif GAUSSIAN_WEIGHTS
             {
                 //Code before optimization:
                 //float2 sigma = blck_size / 2.0f;
@@ -181,3 +213,46 @@ __kernel void calc_hog( const int rows, const int cols, const int step_, __globa
     }
 #endif
 }
+
+#if NORMALIZATION != NORMALIZE_NONE
+//One work item per descriptor, after calc_hog: the descriptor is read once into private memory,
+//normalized there and written back once. Descriptors of norm below FLT_EPSILON become 0.
+__kernel void normalize_hog(const int num_locations, __global float hist_global[][TOTAL_NUMBER_OF_BINS])
+{
+    size_t location_global_idx = get_global_id(0);
+    if (location_global_idx >= num_locations)
+        return;
+
+    //The bins are non-negative, so the L1 norm is their sum
+    float hist[TOTAL_NUMBER_OF_BINS];
+    float sum = 0.0f;
+    for (int i = 0; i < TOTAL_NUMBER_OF_BINS; ++i) {
+        hist[i] = hist_global[location_global_idx][i];
+#if NORMALIZATION == NORMALIZE_L1SQRT
+        sum += hist[i];
+#else
+        sum += hist[i] * hist[i];
+#endif
+    }
+
+#if NORMALIZATION == NORMALIZE_L1SQRT
+    float scale = sum < FLT_EPSILON ? 0.0f : 1.0f / sum;
+    for (int i = 0; i < TOTAL_NUMBER_OF_BINS; ++i)
+        hist_global[location_global_idx][i] = sqrt(hist[i] * scale);
+#else
+    float norm = sqrt(sum);
+    float scale = norm < FLT_EPSILON ? 0.0f : 1.0f / norm;
+#if NORMALIZATION == NORMALIZE_L2HYS
+    sum = 0.0f;
+    for (int i = 0; i < TOTAL_NUMBER_OF_BINS; ++i) {
+        hist[i] = min(hist[i] * scale, L2HYS_THRESHOLD);
+        sum += hist[i] * hist[i];
+    }
+    norm = sqrt(sum);
+    scale = norm < FLT_EPSILON ? 0.0f : 1.0f / norm;
+#endif
+    for (int i = 0; i < TOTAL_NUMBER_OF_BINS; ++i)
+        hist_global[location_global_idx][i] = hist[i] * scale;
+#endif
+}
+#endif
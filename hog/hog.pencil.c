@@ -2,11 +2,25 @@
 
 #include <pencil.h>
 
+#if !__PENCIL__
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+
+//Values of nel::HOGNormalization
+#define NORMALIZE_NONE   0
+#define NORMALIZE_L2     1
+#define NORMALIZE_L2HYS  2
+#define NORMALIZE_L1SQRT 3
+#define L2HYS_THRESHOLD  0.2f   //nel::L2HYS_THRESHOLD
+#define NORM_EPSILON     1.19209290e-7f   //FLT_EPSILON
+
 static void hog_multi( const int NUMBER_OF_CELLS
                      , const int NUMBER_OF_BINS
                      , const int gauss
                      , const int spinterp
                      , const int _signed
+                     , const int normalization
                      , const int rows
                      , const int cols
                      , const int step
@@ -14,6 +28,7 @@ static void hog_multi( const int NUMBER_OF_CELLS
                      , const int num_locations
                      , const float location[static const restrict num_locations][2]
                      , const float blck_size[static const restrict num_locations][2]
+                     , const int max_size
                      , float hist[static const restrict num_locations][NUMBER_OF_CELLS][NUMBER_OF_CELLS][NUMBER_OF_BINS]    //out
                      ) {
 #pragma scop
@@ -23,10 +38,13 @@ static void hog_multi( const int NUMBER_OF_CELLS
     __pencil_assume(NUMBER_OF_CELLS > 0);
     __pencil_assume(NUMBER_OF_BINS  > 0);
     __pencil_assume(num_locations   > 0);
+    __pencil_assume(max_size        > 0);
 
     __pencil_assume(gauss    >= 0);
     __pencil_assume(spinterp >= 0);
     __pencil_assume(_signed  >= 0);
+    __pencil_assume(normalization >= NORMALIZE_NONE);
+    __pencil_assume(normalization <= NORMALIZE_L1SQRT);
 
     __pencil_kill(hist);
 
@@ -36,115 +54,185 @@ static void hog_multi( const int NUMBER_OF_CELLS
                 for(int l = 0; l < NUMBER_OF_BINS; ++l)
                     hist[i][j][k][l] = 0;
 
-    #pragma pencil independent
-    for (int i = 0; i < num_locations; ++i) {
-        float locationx = location[i][0];
-        float locationy = location[i][1];
-        float blck_sizex = blck_size[i][0];
-        float blck_sizey = blck_size[i][1];
-        float minx = locationx - blck_sizex / 2.0f;
-        float miny = locationy - blck_sizey / 2.0f;
-        float maxx = locationx + blck_sizex / 2.0f;
-        float maxy = locationy + blck_sizey / 2.0f;
-
-        int minxi = imax((int)ceilf(minx), 1);
-        int minyi = imax((int)ceilf(miny), 1);
-        int maxxi = imin((int)floorf(maxx), cols - 2);
-        int maxyi = imin((int)floorf(maxy), rows - 2);
-
-        #pragma pencil independent reduction(+:hist[i])
-        for (int pointy = minyi; pointy <= maxyi; ++pointy) {
-            #pragma pencil independent reduction(+:hist[i])
-            for (int pointx = minxi; pointx <= maxxi; ++pointx) {
-                //Read the image
-                int temp1 = pointx-1;
-                int temp2 = pointy-1;
-                float mdx = image[pointy][pointx+1] - image[pointy][temp1];
-                float mdy = image[pointy+1][pointx] - image[temp2][pointx];
-                
-                //calculate the magnitude
-                float magnitude = hypotf(mdx, mdy);
-
-                //calculate the orientation
-                float orientation;
-                if (_signed) {
-                    orientation = atan2pif(mdy, mdx) / 2.0f;
-                } else {
-                    orientation = atan2pif(mdy, mdx) + 0.5f;
-                }
+    {
+#if __PENCIL__
+        float weightx[num_locations][max_size];
+        float weighty[num_locations][max_size];
+#else
+        //Only the Gaussian weighting reads the tables
+        float (*weightx)[max_size] = NULL;
+        float (*weighty)[max_size] = NULL;
+        if (gauss) {
+            weightx = (float (*)[max_size])malloc(sizeof(float)*num_locations*max_size);
+            weighty = (float (*)[max_size])malloc(sizeof(float)*num_locations*max_size);
+            if (!weightx || !weighty) {
+                fprintf(stderr, "pencil_hog: cannot allocate the Gaussian weights of %d locations\n", num_locations);
+                abort();
+            }
+        }
+#endif
+        if (gauss) {
+            //exp(dx^2 * a + dy^2 * b) = exp(dx^2 * a) * exp(dy^2 * b): one weight per column and per row of every block
+            #pragma pencil independent
+            for (int i = 0; i < num_locations; ++i) {
+                float locationx = location[i][0];
+                float locationy = location[i][1];
+                float blck_sizex = blck_size[i][0];
+                float blck_sizey = blck_size[i][1];
+                int minxi = imax((int)ceilf(locationx - blck_sizex / 2.0f), 1);
+                int minyi = imax((int)ceilf(locationy - blck_sizey / 2.0f), 1);
+
+                float sigmax = blck_sizex / 2.0f;
+                float sigmay = blck_sizey / 2.0f;
+                float sigmaSqx = sigmax*sigmax;
+                float sigmaSqy = sigmay*sigmay;
+                float m1p2sigmaSqx = -1.0f / (2.0f * sigmaSqx);
+                float m1p2sigmaSqy = -1.0f / (2.0f * sigmaSqy);
 
-                if (gauss) {
-                    float sigmax = blck_sizex / 2.0f;
-                    float sigmay = blck_sizey / 2.0f;
-                    float sigmaSqx = sigmax*sigmax;
-                    float sigmaSqy = sigmay*sigmay;
-                    float m1p2sigmaSqx = -1.0f / (2.0f * sigmaSqx);
-                    float m1p2sigmaSqy = -1.0f / (2.0f * sigmaSqy);
-                    float distancex = (float)(pointx) - locationx;
-                    float distancey = (float)(pointy) - locationy;
-                    float distanceSqx = distancex * distancex;
-                    float distanceSqy = distancey * distancey;
-                    magnitude *= expf(distanceSqx * m1p2sigmaSqx + distanceSqy * m1p2sigmaSqy);
+                #pragma pencil independent
+                for (int j = 0; j < max_size; ++j) {
+                    float distancex = (float)(minxi + j) - locationx;
+                    float distancey = (float)(minyi + j) - locationy;
+                    weightx[i][j] = expf(distancex * distancex * m1p2sigmaSqx);
+                    weighty[i][j] = expf(distancey * distancey * m1p2sigmaSqy);
                 }
+            }
+        }
 
-                float relative_orientation = orientation * NUMBER_OF_BINS - 0.5f;
-                int bin1 = ceilf(relative_orientation);
-                int bin0 = bin1 - 1;
-                float bin_weight0 = magnitude * (bin1 - relative_orientation);
-                float bin_weight1 = magnitude * (relative_orientation - bin0);
-                bin0 = (bin0 + NUMBER_OF_BINS) % NUMBER_OF_BINS;
-                bin1 = (bin1 + NUMBER_OF_BINS) % NUMBER_OF_BINS;
-		
-		int cellxi;
-		int cellyi;
-
-                if (spinterp) {
-                    float relative_posx = (pointx - minx) * NUMBER_OF_CELLS / blck_sizex - 0.5f;
-                    float relative_posy = (pointy - miny) * NUMBER_OF_CELLS / blck_sizey - 0.5f;
-                    cellxi = (int)floorf(relative_posx);
-                    cellyi = (int)floorf(relative_posy);
-
-                    float xscale1 = relative_posx - (float)(cellxi);
-                    float yscale1 = relative_posy - (float)(cellyi);
-                    float xscale0 = 1.0f - xscale1;
-                    float yscale0 = 1.0f - yscale1;
-
-//                    __pencil_assume(cellxi < NUMBER_OF_CELLS);
-  //                  __pencil_assume(cellyi < NUMBER_OF_CELLS);
-    //                __pencil_assume(cellxi >= 0);
-      //              __pencil_assume(cellyi >= 0);
-                    if (cellyi >= 0 && cellxi >= 0) {
-                        hist[i][cellyi  ][cellxi  ][bin0] += yscale0 * xscale0 * bin_weight0;
-                        hist[i][cellyi  ][cellxi  ][bin1] += yscale0 * xscale0 * bin_weight1;
-                    }
-                    if (cellyi >= 0 && cellxi < NUMBER_OF_CELLS - 1) {
-                        hist[i][cellyi  ][cellxi+1][bin0] += yscale0 * xscale1 * bin_weight0;
-                        hist[i][cellyi  ][cellxi+1][bin1] += yscale0 * xscale1 * bin_weight1;
+        #pragma pencil independent
+        for (int i = 0; i < num_locations; ++i) {
+            float locationx = location[i][0];
+            float locationy = location[i][1];
+            float blck_sizex = blck_size[i][0];
+            float blck_sizey = blck_size[i][1];
+            float minx = locationx - blck_sizex / 2.0f;
+            float miny = locationy - blck_sizey / 2.0f;
+            float maxx = locationx + blck_sizex / 2.0f;
+            float maxy = locationy + blck_sizey / 2.0f;
+
+            int minxi = imax((int)ceilf(minx), 1);
+            int minyi = imax((int)ceilf(miny), 1);
+            int maxxi = imin((int)floorf(maxx), cols - 2);
+            int maxyi = imin((int)floorf(maxy), rows - 2);
+
+            #pragma pencil independent reduction(+:hist[i])
+            for (int pointy = minyi; pointy <= maxyi; ++pointy) {
+                #pragma pencil independent reduction(+:hist[i])
+                for (int pointx = minxi; pointx <= maxxi; ++pointx) {
+                    //Read the image
+                    int temp1 = pointx-1;
+                    int temp2 = pointy-1;
+                    float mdx = image[pointy][pointx+1] - image[pointy][temp1];
+                    float mdy = image[pointy+1][pointx] - image[temp2][pointx];
+                
+                    //calculate the magnitude
+                    float magnitude = hypotf(mdx, mdy);
+
+                    //calculate the orientation
+                    float orientation;
+                    if (_signed) {
+                        orientation = atan2pif(mdy, mdx) / 2.0f;
+                    } else {
+                        orientation = atan2pif(mdy, mdx) + 0.5f;
                     }
-                    if (cellyi < NUMBER_OF_CELLS - 1 && cellxi >= 0) {
-                        hist[i][cellyi+1][cellxi  ][bin0] += yscale1 * xscale0 * bin_weight0;
-                        hist[i][cellyi+1][cellxi  ][bin1] += yscale1 * xscale0 * bin_weight1;
+
+                    if (gauss) {
+                        magnitude *= weighty[i][pointy - minyi] * weightx[i][pointx - minxi];
                     }
-                    if (cellyi < NUMBER_OF_CELLS - 1 && cellxi < NUMBER_OF_CELLS - 1) {
-                        hist[i][cellyi+1][cellxi+1][bin0] += yscale1 * xscale1 * bin_weight0;
-                        hist[i][cellyi+1][cellxi+1][bin1] += yscale1 * xscale1 * bin_weight1;
+
+                    float relative_orientation = orientation * NUMBER_OF_BINS - 0.5f;
+                    int bin1 = ceilf(relative_orientation);
+                    int bin0 = bin1 - 1;
+                    float bin_weight0 = magnitude * (bin1 - relative_orientation);
+                    float bin_weight1 = magnitude * (relative_orientation - bin0);
+                    bin0 = (bin0 + NUMBER_OF_BINS) % NUMBER_OF_BINS;
+                    bin1 = (bin1 + NUMBER_OF_BINS) % NUMBER_OF_BINS;
+		
+    		int cellxi;
+    		int cellyi;
+
+                    if (spinterp) {
+                        float relative_posx = (pointx - minx) * NUMBER_OF_CELLS / blck_sizex - 0.5f;
+                        float relative_posy = (pointy - miny) * NUMBER_OF_CELLS / blck_sizey - 0.5f;
+                        cellxi = (int)floorf(relative_posx);
+                        cellyi = (int)floorf(relative_posy);
+
+                        float xscale1 = relative_posx - (float)(cellxi);
+                        float yscale1 = relative_posy - (float)(cellyi);
+                        float xscale0 = 1.0f - xscale1;
+                        float yscale0 = 1.0f - yscale1;
+
+    //                    __pencil_assume(cellxi < NUMBER_OF_CELLS);
+      //                  __pencil_assume(cellyi < NUMBER_OF_CELLS);
+        //                __pencil_assume(cellxi >= 0);
+          //              __pencil_assume(cellyi >= 0);
+                        if (cellyi >= 0 && cellxi >= 0) {
+                            hist[i][cellyi  ][cellxi  ][bin0] += yscale0 * xscale0 * bin_weight0;
+                            hist[i][cellyi  ][cellxi  ][bin1] += yscale0 * xscale0 * bin_weight1;
+                        }
+                        if (cellyi >= 0 && cellxi < NUMBER_OF_CELLS - 1) {
+                            hist[i][cellyi  ][cellxi+1][bin0] += yscale0 * xscale1 * bin_weight0;
+                            hist[i][cellyi  ][cellxi+1][bin1] += yscale0 * xscale1 * bin_weight1;
+                        }
+                        if (cellyi < NUMBER_OF_CELLS - 1 && cellxi >= 0) {
+                            hist[i][cellyi+1][cellxi  ][bin0] += yscale1 * xscale0 * bin_weight0;
+                            hist[i][cellyi+1][cellxi  ][bin1] += yscale1 * xscale0 * bin_weight1;
+                        }
+                        if (cellyi < NUMBER_OF_CELLS - 1 && cellxi < NUMBER_OF_CELLS - 1) {
+                            hist[i][cellyi+1][cellxi+1][bin0] += yscale1 * xscale1 * bin_weight0;
+                            hist[i][cellyi+1][cellxi+1][bin1] += yscale1 * xscale1 * bin_weight1;
+                        }
+                    } else if (NUMBER_OF_CELLS == 1) {
+                        hist[i][0][0][bin0] += bin_weight0;
+                        hist[i][0][0][bin1] += bin_weight1;
+                    } else {
+                        cellxi = (int)floorf((pointx - minx) * NUMBER_OF_CELLS / blck_sizex);
+                        cellyi = (int)floorf((pointy - miny) * NUMBER_OF_CELLS / blck_sizey);
+
+            //            __pencil_assume(cellxi < NUMBER_OF_CELLS);
+              //          __pencil_assume(cellyi < NUMBER_OF_CELLS);
+                //        __pencil_assume(cellxi >= 0);
+                  //      __pencil_assume(cellyi >= 0);
+                        hist[i][cellyi][cellxi][bin0] += bin_weight0;
+                        hist[i][cellyi][cellxi][bin1] += bin_weight1;
                     }
-                } else if (NUMBER_OF_CELLS == 1) {
-                    hist[i][0][0][bin0] += bin_weight0;
-                    hist[i][0][0][bin1] += bin_weight1;
-                } else {
-                    cellxi = (int)floorf((pointx - minx) * NUMBER_OF_CELLS / blck_sizex);
-                    cellyi = (int)floorf((pointy - miny) * NUMBER_OF_CELLS / blck_sizey);
-
-        //            __pencil_assume(cellxi < NUMBER_OF_CELLS);
-          //          __pencil_assume(cellyi < NUMBER_OF_CELLS);
-            //        __pencil_assume(cellxi >= 0);
-              //      __pencil_assume(cellyi >= 0);
-                    hist[i][cellyi][cellxi][bin0] += bin_weight0;
-                    hist[i][cellyi][cellxi][bin1] += bin_weight1;
                 }
             }
+
+            if (normalization != NORMALIZE_NONE) {
+                //Block normalization while hist[i] is hot; the bins are non-negative, so the L1 norm is their sum
+                float sum = 0.0f;
+                for (int j = 0; j < NUMBER_OF_CELLS; ++j)
+                    for (int k = 0; k < NUMBER_OF_CELLS; ++k)
+                        for (int l = 0; l < NUMBER_OF_BINS; ++l)
+                            sum += (normalization == NORMALIZE_L1SQRT) ? hist[i][j][k][l] : hist[i][j][k][l] * hist[i][j][k][l];
+                float norm = (normalization == NORMALIZE_L1SQRT) ? sum : sqrtf(sum);
+                float scale = (norm < NORM_EPSILON) ? 0.0f : 1.0f / norm;
+                if (normalization == NORMALIZE_L2HYS) {
+                    float sumhys = 0.0f;
+                    for (int j = 0; j < NUMBER_OF_CELLS; ++j)
+                        for (int k = 0; k < NUMBER_OF_CELLS; ++k)
+                            for (int l = 0; l < NUMBER_OF_BINS; ++l) {
+                                hist[i][j][k][l] = fminf(hist[i][j][k][l] * scale, L2HYS_THRESHOLD);
+                                sumhys += hist[i][j][k][l] * hist[i][j][k][l];
+                            }
+                    float normhys = sqrtf(sumhys);
+                    scale = (normhys < NORM_EPSILON) ? 0.0f : 1.0f / normhys;
+                }
+                for (int j = 0; j < NUMBER_OF_CELLS; ++j)
+                    for (int k = 0; k < NUMBER_OF_CELLS; ++k)
+                        for (int l = 0; l < NUMBER_OF_BINS; ++l) {
+                            if (normalization == NORMALIZE_L1SQRT)
+                                hist[i][j][k][l] = sqrtf(hist[i][j][k][l] * scale);
+                            else
+                                hist[i][j][k][l] = hist[i][j][k][l] * scale;
+                        }
+            }
         }
+#if !__PENCIL__
+        free(weightx);
+        free(weighty);
+#endif
     }
     __pencil_kill(location);
     __pencil_kill(image);
@@ -156,6 +244,7 @@ void pencil_hog( const int NUMBER_OF_CELLS
                , const bool gauss
                , const bool spinterp
                , const bool _signed
+               , const int normalization
                , const int rows
                , const int cols
                , const int step
@@ -166,10 +255,16 @@ void pencil_hog( const int NUMBER_OF_CELLS
                , float hist[]    //out
                )
 {
-    hog_multi( NUMBER_OF_CELLS, NUMBER_OF_BINS, gauss, spinterp, _signed
+    //A block covers at most ceil(size) + 1 pixels in each direction
+    int max_size = 1;
+    for (int i = 0; i < num_locations; ++i)
+        max_size = imax(max_size, imax((int)ceilf(blck_size[i][0]), (int)ceilf(blck_size[i][1])) + 1);
+
+    hog_multi( NUMBER_OF_CELLS, NUMBER_OF_BINS, gauss, spinterp, _signed, normalization
              , rows, cols, step, (const uint8_t(*)[step])image
              , num_locations, (const float(*)[2])location
              , blck_size
+             , max_size
              , (float(*)[NUMBER_OF_CELLS][NUMBER_OF_CELLS][NUMBER_OF_BINS])hist
              );
 }
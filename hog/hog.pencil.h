@@ -14,6 +14,7 @@ void pencil_hog( int NUMBER_OF_CELLS
                , bool GAUSSIAN_WEIGHTS
                , bool SPARTIAL_WEIGHTS
                , bool SIGNED_HOG
+               , int normalization     //nel::HOGNormalization
                , const int rows
                , const int cols
                , const int step
@@ -0,0 +1,128 @@
+// Gradients shared by all the HOG locations of an image
+//
+// HOGDescriptorCPP::compute takes the central differences, the magnitude and the
+// orientation of every pixel of every location, so the pixels covered by several
+// blocks are processed once per block. HOGGradientTiles computes them once for the
+// union of the block footprints: the image is split into TILE_SIZE x TILE_SIZE tiles,
+// only the tiles touched by a footprint are computed (in parallel with TBB) and every
+// tile stores its magnitudes and orientations in two separate planes, so a block row
+// reads two contiguous runs of floats. A 100+ MP image never needs dense planes.
+
+#ifndef HOG_GRADIENT_HPP
+#define HOG_GRADIENT_HPP
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#include "hog_simd.hpp"
+
+#ifdef WITH_TBB
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+namespace nel {
+    class HOGGradientTiles {
+    public:
+        enum {
+            TILE_SHIFT = 6,
+            TILE_SIZE  = 1 << TILE_SHIFT,
+            TILE_MASK  = TILE_SIZE - 1,
+        };
+
+        // Computes the gradients of the pixels of the footprints, which must lie in
+        // [1, cols - 2] x [1, rows - 2]. lookup(mdy, mdx, magnitude, orientation) gives
+        // the magnitude and orientation of the central differences mdx and mdy.
+        template <typename Lookup>
+        HOGGradientTiles(const cv::Mat_<uint8_t> &image, const std::vector<cv::Rect> &footprints, const Lookup &lookup)
+            : tilesX((image.cols + TILE_MASK) >> TILE_SHIFT)
+            , tilesY((image.rows + TILE_MASK) >> TILE_SHIFT)
+            , m_index(tilesX * tilesY, -1)
+        {
+            std::vector<int> used;
+            for (const cv::Rect &footprint : footprints) {
+                if (footprint.width <= 0 || footprint.height <= 0)
+                    continue;
+                for (int ty = footprint.y >> TILE_SHIFT; ty <= (footprint.y + footprint.height - 1) >> TILE_SHIFT; ++ty)
+                    for (int tx = footprint.x >> TILE_SHIFT; tx <= (footprint.x + footprint.width - 1) >> TILE_SHIFT; ++tx)
+                        if (m_index[ty * tilesX + tx] < 0) {
+                            m_index[ty * tilesX + tx] = static_cast<int>(used.size());
+                            used.push_back(ty * tilesX + tx);
+                        }
+            }
+            m_magnitude.assign(used.size() * TILE_SIZE * TILE_SIZE, 0.0f);
+            m_orientation.assign(used.size() * TILE_SIZE * TILE_SIZE, 0.0f);
+
+#ifdef WITH_TBB
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, used.size()), [&](const tbb::blocked_range<size_t> range) {
+            for (size_t t = range.begin(); t != range.end(); ++t) {
+#else
+            for (size_t t = 0; t < used.size(); ++t) {
+#endif
+                const int ty = used[t] / tilesX;
+                const int tx = used[t] % tilesX;
+                const int minx = std::max(tx << TILE_SHIFT, 1);
+                const int miny = std::max(ty << TILE_SHIFT, 1);
+                const int maxx = std::min((tx + 1) << TILE_SHIFT, image.cols - 1);
+                const int maxy = std::min((ty + 1) << TILE_SHIFT, image.rows - 1);
+                float *magnitude   = &m_magnitude  [t * TILE_SIZE * TILE_SIZE];
+                float *orientation = &m_orientation[t * TILE_SIZE * TILE_SIZE];
+                for (int y = miny; y < maxy; ++y) {
+                    const uint8_t *above = image[y - 1];
+                    const uint8_t *row   = image[y];
+                    const uint8_t *below = image[y + 1];
+                    const int offset = (y & TILE_MASK) << TILE_SHIFT;
+                    for (int x = minx; x < maxx; ++x)
+                        lookup(below[x] - above[x], row[x + 1] - row[x - 1], magnitude[offset + (x & TILE_MASK)], orientation[offset + (x & TILE_MASK)]);
+                }
+            }
+#ifdef WITH_TBB
+            });
+#endif
+        }
+
+        // Same signature as the per-pixel gradients, for the pixels of the footprints.
+        void operator()(const int y, const int x, float &magnitude, float &orientation) const {
+            const size_t offset = static_cast<size_t>(m_index[(y >> TILE_SHIFT) * tilesX + (x >> TILE_SHIFT)]) * TILE_SIZE * TILE_SIZE
+                                + ((y & TILE_MASK) << TILE_SHIFT) + (x & TILE_MASK);
+            magnitude   = m_magnitude  [offset];
+            orientation = m_orientation[offset];
+        }
+
+#ifdef HOG_SIMD
+        // Pixels x .. x + 7 of row y.
+        void load(const int y, const int x, simd::vfloat &magnitude, simd::vfloat &orientation) const {
+            if ((x & TILE_MASK) + simd::PIXELS <= TILE_SIZE) {
+                const size_t offset = static_cast<size_t>(m_index[(y >> TILE_SHIFT) * tilesX + (x >> TILE_SHIFT)]) * TILE_SIZE * TILE_SIZE
+                                    + ((y & TILE_MASK) << TILE_SHIFT) + (x & TILE_MASK);
+                magnitude   = simd::load(&m_magnitude  [offset]);
+                orientation = simd::load(&m_orientation[offset]);
+            } else {
+                float m[simd::PIXELS], o[simd::PIXELS];
+                for (int l = 0; l < simd::PIXELS; ++l)
+                    (*this)(y, x + l, m[l], o[l]);
+                magnitude   = simd::load(m);
+                orientation = simd::load(o);
+            }
+        }
+#endif
+
+        // Number of computed tiles.
+        size_t size() const {
+            return m_magnitude.size() / (TILE_SIZE * TILE_SIZE);
+        }
+
+    private:
+        int tilesX;
+        int tilesY;
+        std::vector<int> m_index;           // tilesY x tilesX, index of the computed tile or -1
+        std::vector<float> m_magnitude;     // TILE_SIZE x TILE_SIZE per computed tile
+        std::vector<float> m_orientation;
+    };
+}
+
+#endif
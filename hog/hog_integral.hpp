@@ -0,0 +1,139 @@
+// Integral histograms of oriented gradients
+//
+// Without Gaussian weights and spatial interpolation a HOG cell is the sum, over a
+// rectangle of pixels, of the two orientation-bin contributions of every pixel.
+// HOGIntegralHistogram keeps one integral image per orientation bin over the bounding
+// box of the block footprints, so the histogram of any rectangle costs four reads of
+// numberOfBins values whatever its size. The bins of a position are interleaved, so
+// each corner is one contiguous run.
+// The integrals are built like pencil_integral: the row prefix sums of every row are
+// independent (parallel over rows with TBB), then the rows are accumulated downwards
+// (parallel over columns). They are kept in double: float sums of a whole image lose
+// the precision of the cell sums, which are differences of large totals.
+// The tables take 8 x numberOfBins bytes per pixel of the region (bytes()), 72 bytes
+// with 9 bins: 7.2 GB for a 100 MP region. HOGDescriptorCPP::compute only picks them
+// for GRADIENTS_AUTO when they fit in INTEGRAL_MAX_BYTES.
+
+#ifndef HOG_INTEGRAL_HPP
+#define HOG_INTEGRAL_HPP
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#ifdef WITH_TBB
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+namespace nel {
+    class HOGIntegralHistogram {
+    public:
+        // Builds the integral histograms of the pixels of region, which must lie in
+        // [1, cols - 2] x [1, rows - 2]. lookup(mdy, mdx, magnitude, orientation) gives
+        // the magnitude and orientation of the central differences mdx and mdy, the
+        // magnitude is split between the two nearest bins as in HOGDescriptorCPP.
+        template <typename Lookup>
+        HOGIntegralHistogram(const cv::Mat_<uint8_t> &image, const cv::Rect &region_, int numberOfBins_, const Lookup &lookup)
+            : region(region_)
+            , numberOfBins(numberOfBins_)
+            , rowStep(static_cast<size_t>(region_.width + 1) * numberOfBins_)
+            , m_sums(static_cast<size_t>(region_.height + 1) * rowStep, 0.0)
+        {
+            //Row prefix sums
+#ifdef WITH_TBB
+            tbb::parallel_for(tbb::blocked_range<int>(0, region.height), [&](const tbb::blocked_range<int> range) {
+            std::vector<double> run(numberOfBins);
+            for (int r = range.begin(); r != range.end(); ++r) {
+#else
+            std::vector<double> run(numberOfBins);
+            for (int r = 0; r < region.height; ++r) {
+#endif
+                const int y = region.y + r;
+                const uint8_t *above = image[y - 1];
+                const uint8_t *row   = image[y];
+                const uint8_t *below = image[y + 1];
+                double *sums = &m_sums[(r + 1) * rowStep + numberOfBins];
+                std::fill(run.begin(), run.end(), 0.0);
+                for (int x = region.x; x < region.x + region.width; ++x, sums += numberOfBins) {
+                    float magnitude, orientation;
+                    lookup(below[x] - above[x], row[x + 1] - row[x - 1], magnitude, orientation);
+
+                    float relative_orientation = orientation * numberOfBins - 0.5f;
+                    int bin1 = fast_ceil(relative_orientation);
+                    int bin0 = bin1 - 1;
+                    float magscale0 = magnitude * (bin1 - relative_orientation);
+                    float magscale1 = magnitude * (relative_orientation - bin0);
+                    run[(bin0 + numberOfBins) % numberOfBins] += magscale0;
+                    run[(bin1 + numberOfBins) % numberOfBins] += magscale1;
+                    std::copy(run.begin(), run.end(), sums);
+                }
+            }
+#ifdef WITH_TBB
+            });
+#endif
+
+            //Vertical accumulation
+#ifdef WITH_TBB
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, rowStep, 1024), [&](const tbb::blocked_range<size_t> range) {
+            const size_t begin = range.begin();
+            const size_t end = range.end();
+#else
+            {
+            const size_t begin = 0;
+            const size_t end = rowStep;
+#endif
+                for (int r = 1; r < region.height; ++r) {
+                    const double *above = &m_sums[r * rowStep];
+                    double *sums = &m_sums[(r + 1) * rowStep];
+                    for (size_t i = begin; i < end; ++i)
+                        sums[i] += above[i];
+                }
+#ifdef WITH_TBB
+            });
+#else
+            }
+#endif
+        }
+
+        // Memory of the integral histograms of region
+        static double bytes(const cv::Rect &region, const int numberOfBins) {
+            return static_cast<double>(region.width + 1) * (region.height + 1) * numberOfBins * sizeof(double);
+        }
+
+        // Writes the histogram of the pixels [x0, x1) x [y0, y1), in image coordinates
+        // inside the region, to hist[0 .. numberOfBins).
+        void operator()(const int x0, const int y0, const int x1, const int y1, float hist[]) const {
+            if (x1 <= x0 || y1 <= y0) {
+                std::fill(hist, hist + numberOfBins, 0.0f);
+                return;
+            }
+            const double *topleft     = corner(x0, y0);
+            const double *topright    = corner(x1, y0);
+            const double *bottomleft  = corner(x0, y1);
+            const double *bottomright = corner(x1, y1);
+            for (int bin = 0; bin < numberOfBins; ++bin)
+                hist[bin] = static_cast<float>((bottomright[bin] - bottomleft[bin]) - (topright[bin] - topleft[bin]));
+        }
+
+    private:
+        template<typename T>
+        static int fast_ceil(T f) {
+            return static_cast<int>(f)+(f > T(0));
+        }
+
+        const double *corner(const int x, const int y) const {
+            return &m_sums[(y - region.y) * rowStep + (x - region.x) * numberOfBins];
+        }
+
+        cv::Rect region;
+        int numberOfBins;
+        size_t rowStep;                 // (region.width + 1) x numberOfBins
+        std::vector<double> m_sums;     // (region.height + 1) x rowStep, first row and column are zero
+    };
+}
+
+#endif
@@ -0,0 +1,110 @@
+// Magnitude and orientation of the HOG central differences
+//
+// The central differences mdx and mdy of 8-bit images lie in [-255, 255]. A table of
+// all the 511 x 511 pairs takes 2 MB, which does not stay in the L2 cache during the
+// random lookups of the histogram loop, and its 262k atan2 / hypot calls are paid by
+// every descriptor. The magnitude does not depend on the signs of mdx and mdy nor on
+// their order, and the orientation of the other octants follows from the one of
+// 0 <= |mdy| <= |mdx| by reflections, so HOGGradientLookup keeps only that octant:
+// 256 x 257 / 2 entries, 257 kB. The table is built once, on first use, and shared by
+// all the descriptors. The magnitudes are those of the full table, the orientations
+// of the other octants can differ from a direct atan2 in the last bit. With HOG_SIMD
+// 8 pixels are looked up at once; the reflection scales are powers of two, so the
+// vector and scalar orientations are identical.
+
+#ifndef HOG_LOOKUP_HPP
+#define HOG_LOOKUP_HPP
+
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include "hog_simd.hpp"
+
+namespace nel {
+    class HOGGradientLookup {
+    public:
+        explicit HOGGradientLookup(bool _signed)
+            : m_octant(octant().data())
+        {
+            //orientation = offset + scale * octant orientation for the 8 reflections
+            for (int reflection = 0; reflection < 8; ++reflection) {
+                float offset = 0.0f;
+                float scale = 1.0f;
+                if (reflection & SWAPPED) {
+                    offset = 0.25f - offset;
+                    scale = -scale;
+                }
+                if (reflection & NEGATIVE_X) {
+                    offset = 0.5f - offset;
+                    scale = -scale;
+                }
+                if (reflection & NEGATIVE_Y) {
+                    offset = -offset;
+                    scale = -scale;
+                }
+                m_offset[reflection] = _signed ? offset : 2.0f * offset + 0.5f;
+                m_scale [reflection] = _signed ? scale  : 2.0f * scale;
+            }
+        }
+
+        // Orientation in turns: atan2 / pi / 2 if signed, atan2 / pi + 0.5 otherwise.
+        void operator()(const int mdy, const int mdx, float &magnitude, float &orientation) const {
+            const int adx = std::abs(mdx);
+            const int ady = std::abs(mdy);
+            const int hi = std::max(adx, ady);
+            const int lo = adx + ady - hi;
+            const int reflection = (ady > adx) * SWAPPED + (mdx < 0) * NEGATIVE_X + (mdy < 0) * NEGATIVE_Y;
+            const entry &e = m_octant[hi * (hi + 1) / 2 + lo];
+            magnitude = e.magnitude;
+            orientation = m_offset[reflection] + m_scale[reflection] * e.orientation;
+        }
+
+#ifdef HOG_SIMD
+        void operator()(const simd::vint mdy, const simd::vint mdx, simd::vfloat &magnitude, simd::vfloat &orientation) const {
+            using namespace simd;
+            const vint adx = abs(mdx);
+            const vint ady = abs(mdy);
+            const vint hi = max(adx, ady);
+            const vint lo = adx + ady - hi;
+            const vint reflection = (splat(int(SWAPPED)) & (ady > adx)) + (splat(int(NEGATIVE_X)) & (mdx < splat(0))) + (splat(int(NEGATIVE_Y)) & (mdy < splat(0)));
+            const vint index = (((hi * (hi + splat(1))) >> 1) + lo) * splat(2);
+            magnitude = gather(&m_octant->magnitude, index);
+            orientation = permute(m_offset, reflection) + permute(m_scale, reflection) * gather(&m_octant->orientation, index);
+        }
+#endif
+
+    private:
+        enum {
+            SWAPPED    = 1,
+            NEGATIVE_X = 2,
+            NEGATIVE_Y = 4,
+        };
+
+        struct entry {
+            float magnitude;
+            float orientation;  // atan2(lo, hi) in turns, [0, 0.125]
+        };
+
+        // Entries of 0 <= lo <= hi <= 255 at hi * (hi + 1) / 2 + lo.
+        static const std::vector<entry> &octant() {
+            static const std::vector<entry> table = [] {
+                std::vector<entry> t(256 * 257 / 2);
+                for (int hi = 0; hi < 256; ++hi)
+                    for (int lo = 0; lo <= hi; ++lo) {
+                        t[hi * (hi + 1) / 2 + lo].magnitude   = std::hypot(hi, lo);
+                        t[hi * (hi + 1) / 2 + lo].orientation = std::atan2(static_cast<float>(lo), static_cast<float>(hi)) / static_cast<float>(M_PI) / 2.0f;
+                    }
+                return t;
+            }();
+            return table;
+        }
+
+        const entry *m_octant;
+        float m_offset[8];
+        float m_scale[8];
+    };
+}
+
+#endif
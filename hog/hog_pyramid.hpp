@@ -0,0 +1,89 @@
+// Multi-scale HOG
+//
+// Detection runs the same descriptor on 10-20 scaled copies of an image. Resizing and
+// computing them one after the other leaves the cores idle on the small levels, so
+// for_each_pyramid_level runs the levels in parallel with TBB, the largest level
+// first: the levels are ordered by pixel count, which is what the resize and the
+// gradients cost, and the small ones fill the threads while the large ones finish.
+// The parallel loops inside a level (HOGDescriptorCPP::compute) are nested in the
+// level loop, so a single large level still uses every core.
+// Every thread resizes into its own buffer, allocated once for the largest level and
+// reused by the following levels of the thread. The level body is isolated: while a
+// thread waits for the nested loops of its level it only runs tasks of that level,
+// never another level that would overwrite its buffer.
+// The isolation needs TBB 2018 (TBB_INTERFACE_VERSION 10000) or later. With an older
+// TBB the levels run one after the other, each still with the parallel loops of compute.
+
+#ifndef HOG_PYRAMID_HPP
+#define HOG_PYRAMID_HPP
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
+
+#ifdef WITH_TBB
+#include <tbb/parallel_for.h>
+#if TBB_INTERFACE_VERSION >= 10000
+#define HOG_PYRAMID_TBB 1
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/task_arena.h>
+#endif
+#endif
+
+namespace nel {
+    // Size of a level scaled by scale, as cv::resize with fx = fy = scale
+    inline cv::Size pyramid_level_size(const cv::Size &size, const float scale) {
+        return cv::Size(cvRound(size.width * scale), cvRound(size.height * scale));
+    }
+
+    // Calls level(i, scaled) for every scale, scaled being image resized bilinearly by scales[i]
+    // (image itself for a scale of 1). scaled is only valid during the call.
+    template <typename Level>
+    void for_each_pyramid_level(const cv::Mat_<uint8_t> &image, const std::vector<float> &scales, const Level &level) {
+        std::vector<cv::Size> sizes(scales.size());
+        cv::Size largest(0, 0);
+        for (size_t i = 0; i < scales.size(); ++i) {
+            sizes[i] = pyramid_level_size(image.size(), scales[i]);
+            largest.width  = std::max(largest.width , sizes[i].width );
+            largest.height = std::max(largest.height, sizes[i].height);
+        }
+
+        //Largest levels first
+        std::vector<size_t> order(scales.size());
+        std::iota(order.begin(), order.end(), size_t(0));
+        std::stable_sort(order.begin(), order.end(), [&](const size_t a, const size_t b) { return sizes[a].area() > sizes[b].area(); });
+
+        const auto run = [&](const size_t i, cv::Mat_<uint8_t> &buffer) {
+            if (1.0f == scales[i]) {
+                level(i, image);
+                return;
+            }
+            if (buffer.empty())
+                buffer.create(largest.height, largest.width);
+            //cv::resize keeps the buffer when the destination has the right size
+            cv::Mat_<uint8_t> scaled = buffer(cv::Rect(0, 0, sizes[i].width, sizes[i].height));
+            cv::resize(image, scaled, sizes[i], 0, 0, cv::INTER_LINEAR);
+            level(i, static_cast<const cv::Mat_<uint8_t> &>(scaled));
+        };
+
+#ifdef HOG_PYRAMID_TBB
+        tbb::enumerable_thread_specific<cv::Mat_<uint8_t>> buffers;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, order.size(), 1), [&](const tbb::blocked_range<size_t> range) {
+            for (size_t k = range.begin(); k != range.end(); ++k)
+                tbb::this_task_arena::isolate([&] { run(order[k], buffers.local()); });
+        });
+#else
+        cv::Mat_<uint8_t> buffer;
+        for (size_t k = 0; k < order.size(); ++k)
+            run(order[k], buffer);
+#endif
+    }
+}
+
+#endif
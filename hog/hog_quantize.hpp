@@ -0,0 +1,168 @@
+// Quantized HOG descriptors
+//
+// HOGDescriptorCPP::compute writes float32 descriptors, 4 bytes per bin. The other
+// output formats are written by computeAs from the float histogram of every location
+// as soon as it is complete and normalized, so the float descriptor matrix is never
+// stored:
+//  - fp16 (IEEE binary16, 11 significant bits) and bfloat16 (the float exponent and
+//    8 significant bits) as uint16_t bit patterns (CV_16U), rounded to nearest even;
+//  - uint8 (CV_8U) as round(255 * v) of normalized descriptors, whose bins are in [0, 1].
+// dequantize_descriptors converts them back to float.
+
+#ifndef HOG_QUANTIZE_HPP
+#define HOG_QUANTIZE_HPP
+
+#include <opencv2/core/core.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace nel {
+    enum HOGOutputFormat {
+        OUTPUT_FLOAT32,
+        OUTPUT_FLOAT16,
+        OUTPUT_BFLOAT16,
+        OUTPUT_UINT8,
+    };
+
+    // OpenCV type of the descriptors in the given format
+    inline int output_type(const HOGOutputFormat format) {
+        switch (format) {
+        case OUTPUT_FLOAT16:
+        case OUTPUT_BFLOAT16:
+            return CV_16U;
+        case OUTPUT_UINT8:
+            return CV_8U;
+        default:
+            return CV_32F;
+        }
+    }
+
+    inline uint16_t float_to_half(const float f) {
+#if defined(__F16C__)
+        return static_cast<uint16_t>(_cvtss_sh(f, 0));
+#else
+        uint32_t x;
+        std::memcpy(&x, &f, sizeof(x));
+        const uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000);
+        const uint32_t abs = x & 0x7FFFFFFF;
+        if (abs > 0x7F800000)           // NaN
+            return sign | 0x7E00;
+        if (abs >= 0x477FF000)          // rounds above 65504
+            return sign | 0x7C00;
+        if (abs < 0x38800000) {         // below 2^-14: subnormal, in units of 2^-24
+            const int shift = 126 - static_cast<int>(abs >> 23);
+            if (shift > 24)
+                return sign;
+            const uint32_t mantissa = (abs & 0x7FFFFF) | 0x800000;
+            const uint32_t half = mantissa >> shift;
+            const uint32_t rest = mantissa & ((1u << shift) - 1);
+            const uint32_t tie = 1u << (shift - 1);
+            return sign | static_cast<uint16_t>(half + (rest > tie || (rest == tie && (half & 1))));
+        }
+        //Rebias the exponent, round the 13 dropped bits; a carry into the exponent is still right
+        const uint32_t half = (abs - 0x38000000) >> 13;
+        const uint32_t rest = abs & 0x1FFF;
+        return sign | static_cast<uint16_t>(half + (rest > 0x1000 || (rest == 0x1000 && (half & 1))));
+#endif
+    }
+
+    inline float half_to_float(const uint16_t h) {
+#if defined(__F16C__)
+        return _cvtsh_ss(h);
+#else
+        const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+        const uint32_t exponent = (h >> 10) & 0x1F;
+        const uint32_t mantissa = h & 0x3FF;
+        if (0 == exponent) {
+            const float subnormal = std::ldexp(static_cast<float>(mantissa), -24);
+            return sign ? -subnormal : subnormal;
+        }
+        const uint32_t x = sign | (0x1F == exponent ? 0x7F800000 : (exponent + 112) << 23) | (mantissa << 13);
+        float f;
+        std::memcpy(&f, &x, sizeof(f));
+        return f;
+#endif
+    }
+
+    inline uint16_t float_to_bfloat16(const float f) {
+        uint32_t x;
+        std::memcpy(&x, &f, sizeof(x));
+        if ((x & 0x7FFFFFFF) > 0x7F800000)
+            return static_cast<uint16_t>((x >> 16) | 0x40);
+        return static_cast<uint16_t>((x + 0x7FFF + ((x >> 16) & 1)) >> 16);
+    }
+
+    inline float bfloat16_to_float(const uint16_t b) {
+        const uint32_t x = static_cast<uint32_t>(b) << 16;
+        float f;
+        std::memcpy(&f, &x, sizeof(f));
+        return f;
+    }
+
+    inline uint8_t float_to_unorm8(const float f) {
+        return static_cast<uint8_t>(std::min(std::max(f, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+
+    // Writes hist[0 .. size) to the descriptor row in the given format (nothing to do for
+    // float32 when hist is the row itself).
+    inline void quantize_descriptor(const float hist[], const int size, const HOGOutputFormat format, uint8_t row[]) {
+        switch (format) {
+        case OUTPUT_FLOAT32:
+            if (reinterpret_cast<const float *>(row) != hist)
+                std::copy(hist, hist + size, reinterpret_cast<float *>(row));
+            break;
+        case OUTPUT_FLOAT16: {
+            uint16_t *out = reinterpret_cast<uint16_t *>(row);
+            int i = 0;
+#if defined(__F16C__) && defined(__AVX__)
+            for (; i + 8 <= size; i += 8)
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(hist + i), 0));
+#endif
+            for (; i < size; ++i)
+                out[i] = float_to_half(hist[i]);
+            break;
+        }
+        case OUTPUT_BFLOAT16: {
+            uint16_t *out = reinterpret_cast<uint16_t *>(row);
+            for (int i = 0; i < size; ++i)
+                out[i] = float_to_bfloat16(hist[i]);
+            break;
+        }
+        case OUTPUT_UINT8:
+            for (int i = 0; i < size; ++i)
+                row[i] = float_to_unorm8(hist[i]);
+            break;
+        }
+    }
+
+    // The descriptors of computeAs as float
+    inline cv::Mat_<float> dequantize_descriptors(const cv::Mat &descriptors, const HOGOutputFormat format) {
+        cv::Mat_<float> result(descriptors.rows, descriptors.cols);
+        for (int n = 0; n < descriptors.rows; ++n)
+            for (int i = 0; i < descriptors.cols; ++i)
+                switch (format) {
+                case OUTPUT_FLOAT32:
+                    result(n, i) = descriptors.at<float>(n, i);
+                    break;
+                case OUTPUT_FLOAT16:
+                    result(n, i) = half_to_float(descriptors.at<uint16_t>(n, i));
+                    break;
+                case OUTPUT_BFLOAT16:
+                    result(n, i) = bfloat16_to_float(descriptors.at<uint16_t>(n, i));
+                    break;
+                case OUTPUT_UINT8:
+                    result(n, i) = descriptors.at<uint8_t>(n, i) / 255.0f;
+                    break;
+                }
+        return result;
+    }
+}
+
+#endif
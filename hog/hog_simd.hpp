@@ -0,0 +1,289 @@
+// Vectorized HOG block histograms
+//
+// accumulate_block computes the histogram of one block 8 pixels at a time: the
+// gradients come from the gradient provider (central differences and the octant
+// lookup table, or the shared tiles), the Gaussian weights from the precomputed row
+// and column vectors, and the orientation bins, bin weights, cells and spatial
+// weights are computed in vector registers. There is no scatter: every pixel adds
+// at most four (cell, bin) contributions, and the row histogram keeps one vector of
+// 8 lane sums per (cell column, bin), so each of them is updated with compares and
+// masked adds. Only the cell columns touched by the 8 pixels are visited. At the end
+// of a block row the row histogram is added, with the spatial weights of the row,
+// to the cell rows it contributes to; the lanes are summed once per block.
+// Both histograms live in a scratch buffer of the caller, block_scratch_size floats
+// (under 2 KB for 2x2 cells of 9 bins), reused by all the blocks of a thread.
+// The vector primitives are AVX2 (8 lanes) or NEON on AArch64 (two 4-lane halves);
+// HOG_SIMD is defined when one of them is available.
+
+#ifndef HOG_SIMD_HPP
+#define HOG_SIMD_HPP
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HOG_SIMD 1
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && defined(__aarch64__)
+#include <arm_neon.h>
+#define HOG_SIMD 1
+#endif
+
+#ifdef HOG_SIMD
+namespace nel {
+namespace simd {
+
+    enum {
+        PIXELS = 8,     // pixels per vector
+    };
+
+#if defined(__AVX2__)
+    struct vint   { __m256i v; };
+    struct vfloat { __m256  v; };
+
+    inline vint   splat(const int   x) { return { _mm256_set1_epi32(x) }; }
+    inline vfloat splat(const float x) { return { _mm256_set1_ps(x) }; }
+    inline vint   ramp() { return { _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7) }; }
+
+    inline vint   load_u8(const uint8_t p[]) { return { _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))) }; }
+    inline vfloat load(const float p[]) { return { _mm256_loadu_ps(p) }; }
+    inline void   store(float p[], const vfloat a) { _mm256_storeu_ps(p, a.v); }
+    inline void   store(int p[], const vint a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a.v); }
+
+    inline vint operator+(const vint a, const vint b) { return { _mm256_add_epi32(a.v, b.v) }; }
+    inline vint operator-(const vint a, const vint b) { return { _mm256_sub_epi32(a.v, b.v) }; }
+    inline vint operator*(const vint a, const vint b) { return { _mm256_mullo_epi32(a.v, b.v) }; }
+    inline vint operator&(const vint a, const vint b) { return { _mm256_and_si256(a.v, b.v) }; }
+    inline vint operator>>(const vint a, const int n) { return { _mm256_srai_epi32(a.v, n) }; }
+    inline vint abs(const vint a) { return { _mm256_abs_epi32(a.v) }; }
+    inline vint max(const vint a, const vint b) { return { _mm256_max_epi32(a.v, b.v) }; }
+    inline vint operator==(const vint a, const vint b) { return { _mm256_cmpeq_epi32(a.v, b.v) }; }
+    inline vint operator> (const vint a, const vint b) { return { _mm256_cmpgt_epi32(a.v, b.v) }; }
+
+    inline vfloat operator+(const vfloat a, const vfloat b) { return { _mm256_add_ps(a.v, b.v) }; }
+    inline vfloat operator-(const vfloat a, const vfloat b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    inline vfloat operator*(const vfloat a, const vfloat b) { return { _mm256_mul_ps(a.v, b.v) }; }
+    inline vfloat operator/(const vfloat a, const vfloat b) { return { _mm256_div_ps(a.v, b.v) }; }
+    inline vint operator> (const vfloat a, const vfloat b) { return { _mm256_castps_si256(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)) }; }
+
+    inline vfloat to_float(const vint a) { return { _mm256_cvtepi32_ps(a.v) }; }
+    inline vint   truncate(const vfloat a) { return { _mm256_cvttps_epi32(a.v) }; }
+    // a where mask is set, 0 elsewhere
+    inline vfloat masked(const vint mask, const vfloat a) { return { _mm256_and_ps(_mm256_castsi256_ps(mask.v), a.v) }; }
+
+    // base[index] for every lane
+    inline vfloat gather(const float base[], const vint index) { return { _mm256_i32gather_ps(base, index.v, 4) }; }
+    // table[index] for indices in [0, 8)
+    inline vfloat permute(const float table[PIXELS], const vint index) { return { _mm256_permutevar8x32_ps(_mm256_loadu_ps(table), index.v) }; }
+
+    inline float sum(const vfloat a) {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_movehdup_ps(s));
+        return _mm_cvtss_f32(s);
+    }
+#else
+    struct vint   { int32x4_t   lo, hi; };
+    struct vfloat { float32x4_t lo, hi; };
+
+    inline vint   splat(const int   x) { return { vdupq_n_s32(x), vdupq_n_s32(x) }; }
+    inline vfloat splat(const float x) { return { vdupq_n_f32(x), vdupq_n_f32(x) }; }
+    inline vint   ramp() { const int32_t r[PIXELS] = { 0, 1, 2, 3, 4, 5, 6, 7 }; return { vld1q_s32(r), vld1q_s32(r + 4) }; }
+
+    inline vint load_u8(const uint8_t p[]) {
+        const uint16x8_t wide = vmovl_u8(vld1_u8(p));
+        return { vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(wide))), vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(wide))) };
+    }
+    inline vfloat load(const float p[]) { return { vld1q_f32(p), vld1q_f32(p + 4) }; }
+    inline void   store(float p[], const vfloat a) { vst1q_f32(p, a.lo); vst1q_f32(p + 4, a.hi); }
+    inline void   store(int p[], const vint a) { vst1q_s32(p, a.lo); vst1q_s32(p + 4, a.hi); }
+
+    inline vint operator+(const vint a, const vint b) { return { vaddq_s32(a.lo, b.lo), vaddq_s32(a.hi, b.hi) }; }
+    inline vint operator-(const vint a, const vint b) { return { vsubq_s32(a.lo, b.lo), vsubq_s32(a.hi, b.hi) }; }
+    inline vint operator*(const vint a, const vint b) { return { vmulq_s32(a.lo, b.lo), vmulq_s32(a.hi, b.hi) }; }
+    inline vint operator&(const vint a, const vint b) { return { vandq_s32(a.lo, b.lo), vandq_s32(a.hi, b.hi) }; }
+    inline vint operator>>(const vint a, const int n) { return { vshlq_s32(a.lo, vdupq_n_s32(-n)), vshlq_s32(a.hi, vdupq_n_s32(-n)) }; }
+    inline vint abs(const vint a) { return { vabsq_s32(a.lo), vabsq_s32(a.hi) }; }
+    inline vint max(const vint a, const vint b) { return { vmaxq_s32(a.lo, b.lo), vmaxq_s32(a.hi, b.hi) }; }
+    inline vint operator==(const vint a, const vint b) { return { vreinterpretq_s32_u32(vceqq_s32(a.lo, b.lo)), vreinterpretq_s32_u32(vceqq_s32(a.hi, b.hi)) }; }
+    inline vint operator> (const vint a, const vint b) { return { vreinterpretq_s32_u32(vcgtq_s32(a.lo, b.lo)), vreinterpretq_s32_u32(vcgtq_s32(a.hi, b.hi)) }; }
+
+    inline vfloat operator+(const vfloat a, const vfloat b) { return { vaddq_f32(a.lo, b.lo), vaddq_f32(a.hi, b.hi) }; }
+    inline vfloat operator-(const vfloat a, const vfloat b) { return { vsubq_f32(a.lo, b.lo), vsubq_f32(a.hi, b.hi) }; }
+    inline vfloat operator*(const vfloat a, const vfloat b) { return { vmulq_f32(a.lo, b.lo), vmulq_f32(a.hi, b.hi) }; }
+    inline vfloat operator/(const vfloat a, const vfloat b) { return { vdivq_f32(a.lo, b.lo), vdivq_f32(a.hi, b.hi) }; }
+    inline vint operator> (const vfloat a, const vfloat b) { return { vreinterpretq_s32_u32(vcgtq_f32(a.lo, b.lo)), vreinterpretq_s32_u32(vcgtq_f32(a.hi, b.hi)) }; }
+
+    inline vfloat to_float(const vint a) { return { vcvtq_f32_s32(a.lo), vcvtq_f32_s32(a.hi) }; }
+    inline vint   truncate(const vfloat a) { return { vcvtq_s32_f32(a.lo), vcvtq_s32_f32(a.hi) }; }
+    inline vfloat masked(const vint mask, const vfloat a) {
+        return { vreinterpretq_f32_s32(vandq_s32(mask.lo, vreinterpretq_s32_f32(a.lo))), vreinterpretq_f32_s32(vandq_s32(mask.hi, vreinterpretq_s32_f32(a.hi))) };
+    }
+
+    // NEON has no gather, the lanes are loaded one by one
+    inline vfloat gather(const float base[], const vint index) {
+        int32_t i[PIXELS];
+        store(i, index);
+        float g[PIXELS];
+        for (int l = 0; l < PIXELS; ++l)
+            g[l] = base[i[l]];
+        return load(g);
+    }
+    inline vfloat permute(const float table[PIXELS], const vint index) { return gather(table, index); }
+
+    inline float sum(const vfloat a) { return vaddvq_f32(vaddq_f32(a.lo, a.hi)); }
+#endif
+
+    inline vint operator<(const vint a, const vint b) { return b > a; }
+    inline vint operator<(const vfloat a, const vfloat b) { return b > a; }
+
+    // fast_floor and fast_ceil of test_hog.cpp: the masks are -1
+    inline vint floor(const vfloat a) { return truncate(a) + (a < splat(0.0f)); }
+    inline vint ceil (const vfloat a) { return truncate(a) - (a > splat(0.0f)); }
+
+    // (bin + bins) % bins for bin in [-bins, 2 * bins)
+    inline vint wrap(const vint bin, const vint bins) {
+        vint wrapped = bin + bins;
+        wrapped = wrapped - (bins & (wrapped > bins - splat(1)));
+        return wrapped - (bins & (wrapped > bins - splat(1)));
+    }
+
+    // Floats of the scratch buffer of accumulate_block: the cell histograms and the row histogram
+    template <typename Config>
+    inline size_t block_scratch_size(const Config &config) {
+        return static_cast<size_t>(config.numberOfCells + 1) * config.numberOfCells * config.numberOfBins * PIXELS;
+    }
+
+    // Histogram of the block footprint into hist[numberOfCells * numberOfCells * numberOfBins],
+    // with the cells, bins and weights of HOGDescriptorCPP::computeLocations; config gives numberOfCells,
+    // numberOfBins and spinterp, as constants for the specialized configurations. gradients(y, x, magnitude,
+    // orientation) gives one pixel, gradients.load(y, x, magnitude, orientation) 8 pixels of the footprint.
+    // weightsX and weightsY are the Gaussian weights of the columns and rows of the footprint (nullptr
+    // without Gaussian weights), weightsX has PIXELS - 1 readable entries after the last column.
+    // scratch has block_scratch_size(config) floats.
+    template <typename Config, typename Gradients>
+    void accumulate_block( const Config    &config
+                         , const Gradients &gradients
+                         , const cv::Rect  &footprint
+                         , const float      minx
+                         , const float      miny
+                         , const float      cellsizeX
+                         , const float      cellsizeY
+                         , const float      weightsX[]
+                         , const float      weightsY[]
+                         , float            scratch[]
+                         , float            hist[]
+                         )
+    {
+        const int  numberOfCells = config.numberOfCells;
+        const int  numberOfBins  = config.numberOfBins;
+        const bool spinterp      = config.spinterp;
+        const int cellBins = numberOfCells * numberOfBins;
+        float * const cells = scratch;                                  // cell row x cell column x bin x lane
+        float * const row = scratch + numberOfCells * cellBins * PIXELS;  // cell column x bin x lane
+        std::fill(cells, cells + numberOfCells * cellBins * PIXELS, 0.0f);
+        const vint bins = splat(numberOfBins);
+        const vint lanes = ramp();
+        const int endx = footprint.x + footprint.width;
+
+        for (int pointy = footprint.y; pointy < footprint.y + footprint.height; ++pointy) {
+            //Cell rows of the block row and their weights
+            int cellyi = 0;
+            float yscale0 = 1.0f;
+            float yscale1 = 0.0f;
+            if (spinterp) {
+                float relative_pos_y = (pointy - miny) / cellsizeY - 0.5f;
+                cellyi = static_cast<int>(relative_pos_y) - (relative_pos_y < 0.0f);
+                yscale1 = relative_pos_y - cellyi;
+                yscale0 = 1.0f - yscale1;
+            } else if (numberOfCells > 1) {
+                float relative_pos_y = (pointy - miny) / cellsizeY;
+                cellyi = static_cast<int>(relative_pos_y) - (relative_pos_y < 0.0f);
+            }
+            const vfloat weightY = splat(weightsY ? weightsY[pointy - footprint.y] : 1.0f);
+
+            std::fill(row, row + cellBins * PIXELS, 0.0f);
+            for (int pointx = footprint.x; pointx < endx; pointx += PIXELS) {
+                vfloat magnitude, orientation;
+                if (pointx + PIXELS <= endx) {
+                    gradients.load(pointy, pointx, magnitude, orientation);
+                } else {
+                    //Last pixels of the row, the missing lanes have no magnitude
+                    float m[PIXELS] = {}, o[PIXELS] = {};
+                    for (int l = 0; l < endx - pointx; ++l)
+                        gradients(pointy, pointx + l, m[l], o[l]);
+                    magnitude = load(m);
+                    orientation = load(o);
+                }
+                if (weightsX)
+                    magnitude = magnitude * (weightY * load(weightsX + pointx - footprint.x));
+
+                // linear interpolation of magnitudes between the two nearest bins
+                const vfloat relative_orientation = orientation * splat(static_cast<float>(numberOfBins)) - splat(0.5f);
+                const vint bin1 = ceil(relative_orientation);
+                const vint bin0 = bin1 - splat(1);
+                const vfloat magscale0 = magnitude * (to_float(bin1) - relative_orientation);
+                const vfloat magscale1 = magnitude * (relative_orientation - to_float(bin0));
+                const vint binidx0 = wrap(bin0, bins);
+                const vint binidx1 = wrap(bin1, bins);
+
+                //Cell columns: index of the first (cell column, bin) of every lane and its weights
+                const vfloat pointxf = to_float(splat(pointx) + lanes);
+                vint cellxi = splat(0);
+                vfloat v00 = magscale0, v01 = magscale1, v10, v11;
+                if (spinterp) {
+                    const vfloat relative_pos_x = (pointxf - splat(minx)) / splat(cellsizeX) - splat(0.5f);
+                    cellxi = floor(relative_pos_x);
+                    const vfloat xscale1 = relative_pos_x - to_float(cellxi);
+                    const vfloat xscale0 = splat(1.0f) - xscale1;
+                    v00 = xscale0 * magscale0;
+                    v01 = xscale0 * magscale1;
+                    v10 = xscale1 * magscale0;
+                    v11 = xscale1 * magscale1;
+                } else if (numberOfCells > 1) {
+                    cellxi = floor((pointxf - splat(minx)) / splat(cellsizeX));
+                }
+                const vint k00 = cellxi * bins + binidx0;
+                const vint k01 = cellxi * bins + binidx1;
+                const vint k10 = k00 + bins;
+                const vint k11 = k01 + bins;
+
+                //The cell columns grow with x: only those of the first and the last lane are touched
+                int cellx[PIXELS];
+                store(cellx, cellxi);
+                const int first = std::max(cellx[0], 0) * numberOfBins;
+                const int last = std::min(cellx[PIXELS - 1] + (spinterp ? 2 : 1), numberOfCells) * numberOfBins;
+                for (int k = first; k < last; ++k) {
+                    const vint key = splat(k);
+                    vfloat add = masked(k00 == key, v00) + masked(k01 == key, v01);
+                    if (spinterp)
+                        add = add + masked(k10 == key, v10) + masked(k11 == key, v11);
+                    store(&row[k * PIXELS], load(&row[k * PIXELS]) + add);
+                }
+            }
+
+            //Add the block row to its cell rows
+            for (int celly = 0; celly < 2; ++celly) {
+                const int target = cellyi + celly;
+                const float yscale = celly ? yscale1 : yscale0;
+                if (target < 0 || target >= numberOfCells || (celly && !spinterp))
+                    continue;
+                const vfloat weight = splat(yscale);
+                float *cell = &cells[target * cellBins * PIXELS];
+                for (int k = 0; k < cellBins; ++k)
+                    store(&cell[k * PIXELS], load(&cell[k * PIXELS]) + weight * load(&row[k * PIXELS]));
+            }
+        }
+
+        for (int k = 0; k < numberOfCells * cellBins; ++k)
+            hist[k] = sum(load(&cells[k * PIXELS]));
+    }
+}
+}
+#endif
+
+#endif
@@ -1,7 +1,11 @@
 #include "utility.hpp"
 #include "HogDescriptor.h"
+#include "hog_gradient.hpp"
+#include "hog_integral.hpp"
+#include "hog_pyramid.hpp"
 
 #include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/ocl/ocl.hpp>
 
 #ifndef EXCLUDE_PENCIL_TEST
@@ -15,6 +19,7 @@
 #include <chrono>
 #include <random>
 #include <array>
+#include <numeric>
 #include <algorithm>
 #include <cfloat>
 #include <cassert>
@@ -24,6 +29,7 @@
 #ifdef WITH_TBB
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
 #endif
 
 #ifndef BLOCK_SIZE
@@ -54,6 +60,26 @@
 #define SIGNED_HOG 1
 #endif
 
+#ifndef INTEGRAL_COST
+#define INTEGRAL_COST 4
+#endif
+
+#ifndef INTEGRAL_MAX_BYTES
+#define INTEGRAL_MAX_BYTES (1 << 30)
+#endif
+
+#ifndef DENSE_TILE_CELLS
+#define DENSE_TILE_CELLS 4
+#endif
+
+#ifndef PARTITION_COST
+#define PARTITION_COST 4096
+#endif
+
+#ifndef LOCATION_COST
+#define LOCATION_COST 64
+#endif
+
 #define HOG_OPENCL_CL "hog/hog.opencl.cl"
 
 namespace {
@@ -72,52 +98,224 @@ namespace {
     inline size_t round_to_multiple(size_t num, size_t factor) {
         return num + factor - 1 - (num - 1) % factor;
     }
+
+    // The dense grid divides the image by the cell size
+    inline void check_cell_size(const cv::Size &cellsize) {
+        if (cellsize.width <= 0 || cellsize.height <= 0)
+            throw std::runtime_error("The dense grid needs a positive cell size.");
+    }
+
+    // Pixels of the block around (centerx, centery) whose central differences are inside the image.
+    inline cv::Rect block_footprint(int rows, int cols, float centerx, float centery, float blocksizeX, float blocksizeY) {
+        const int minxi = std::max(fast_ceil (centerx - blocksizeX / 2.0f), 1);
+        const int minyi = std::max(fast_ceil (centery - blocksizeY / 2.0f), 1);
+        const int maxxi = std::min(fast_floor(centerx + blocksizeX / 2.0f), cols - 2);
+        const int maxyi = std::min(fast_floor(centery + blocksizeY / 2.0f), rows - 2);
+        return cv::Rect(minxi, minyi, std::max(maxxi - minxi + 1, 0), std::max(maxyi - minyi + 1, 0));
+    }
+
+    // First pixel of [first, end) in the given cell or after it, the cell of x being
+    // fast_floor((x - min) / cellsize) as in HOGDescriptorCPP::compute; end if there is none.
+    inline int cell_start(int first, int end, float min, float cellsize, int cell) {
+        int x = std::min(std::max(fast_ceil(min + cell * cellsize), first), end);
+        while (x > first && fast_floor((x - 1 - min) / cellsize) >= cell)
+            --x;
+        while (x < end && fast_floor((x - min) / cellsize) < cell)
+            ++x;
+        return x;
+    }
+
+    // Interleaves the bits of x and y: consecutive keys are close in the image at every scale (Z-order curve).
+    inline uint64_t morton_key(const uint32_t x, const uint32_t y) {
+        uint64_t key = 0;
+        for (int bit = 0; bit < 32; ++bit)
+            key |= (static_cast<uint64_t>((x >> bit) & 1) << (2 * bit)) | (static_cast<uint64_t>((y >> bit) & 1) << (2 * bit + 1));
+        return key;
+    }
+
+    // Gradients computed from the image for every pixel read.
+    struct PixelGradients {
+        const cv::Mat_<uint8_t> &image;
+        const nel::HOGGradientLookup &lookupTable;
+
+        void operator()(const int pointy, const int pointx, float &magnitude, float &orientation) const {
+            int mdxi = image(pointy, pointx + 1) - image(pointy, pointx - 1);
+            int mdyi = image(pointy + 1, pointx) - image(pointy - 1, pointx);
+            lookupTable(mdyi, mdxi, magnitude, orientation);
+        }
+
+#ifdef HOG_SIMD
+        void load(const int pointy, const int pointx, nel::simd::vfloat &magnitude, nel::simd::vfloat &orientation) const {
+            using namespace nel::simd;
+            const vint mdx = load_u8(image[pointy] + pointx + 1) - load_u8(image[pointy] + pointx - 1);
+            const vint mdy = load_u8(image[pointy + 1] + pointx) - load_u8(image[pointy - 1] + pointx);
+            lookupTable(mdy, mdx, magnitude, orientation);
+        }
+#endif
+    };
+
+    // Normalizes the descriptor hist[0 .. size) in place; descriptors of norm below FLT_EPSILON become 0.
+    inline void normalize_descriptor(float hist[], const int size, const nel::HOGNormalization normalization) {
+        if (nel::NORMALIZE_NONE == normalization)
+            return;
+
+        //The bins are non-negative, so the L1 norm is their sum
+        float sum = 0.0f;
+        for (int i = 0; i < size; ++i)
+            sum += nel::NORMALIZE_L1SQRT == normalization ? hist[i] : hist[i] * hist[i];
+        if (nel::NORMALIZE_L1SQRT == normalization) {
+            const float scale = sum < FLT_EPSILON ? 0.0f : 1.0f / sum;
+            for (int i = 0; i < size; ++i)
+                hist[i] = std::sqrt(hist[i] * scale);
+            return;
+        }
+
+        float norm = std::sqrt(sum);
+        float scale = norm < FLT_EPSILON ? 0.0f : 1.0f / norm;
+        if (nel::NORMALIZE_L2HYS == normalization) {
+            sum = 0.0f;
+            for (int i = 0; i < size; ++i) {
+                hist[i] = std::min(hist[i] * scale, nel::L2HYS_THRESHOLD);
+                sum += hist[i] * hist[i];
+            }
+            norm = std::sqrt(sum);
+            scale = norm < FLT_EPSILON ? 0.0f : 1.0f / norm;
+        }
+        for (int i = 0; i < size; ++i)
+            hist[i] *= scale;
+    }
+
+    // Sum of a[i] * b[i] for i in [0, size)
+    inline float dot(const float a[], const float b[], const int size) {
+        int i = 0;
+        float sum = 0.0f;
+#ifdef HOG_SIMD
+        nel::simd::vfloat sums = nel::simd::splat(0.0f);
+        for (; i + nel::simd::PIXELS <= size; i += nel::simd::PIXELS)
+            sums = sums + nel::simd::load(a + i) * nel::simd::load(b + i);
+        sum = nel::simd::sum(sums);
+#endif
+        for (; i < size; ++i)
+            sum += a[i] * b[i];
+        return sum;
+    }
+
+    // Configuration of HOGDescriptorCPP::computeLocations known at run time.
+    struct RuntimeConfig {
+        int numberOfCells;
+        int numberOfBins;
+        bool gauss;
+        bool spinterp;
+    };
+
+    // Per-thread buffers of the block histograms of HOGDescriptorCPP::computeLocations, sized by the
+    // first block of the thread and reused by the following ones.
+    struct BlockScratch {
+        std::vector<float> weightsX;    // Gaussian weights of the footprint columns
+        std::vector<float> weightsY;    // Gaussian weights of the footprint rows
+        std::vector<float> block;       // nel::simd::accumulate_block
+        std::vector<float> descriptor;  // float histogram of a block stored in another output format
+    };
+
+    // Configuration compiled in, like the -D constants of the OpenCL kernel: the
+    // branches on the flags vanish and the bin modulo is by a constant.
+    template <int Cells, int Bins, bool Gauss, bool Spinterp>
+    struct FixedConfig {
+        enum {
+            numberOfCells = Cells,
+            numberOfBins  = Bins,
+            gauss         = Gauss,
+            spinterp      = Spinterp,
+        };
+    };
 }
 
-nel::HOGDescriptorCPP::HOGDescriptorCPP(int numberOfCells_, int numberOfBins_, bool gauss_, bool spinterp_, bool _signed_)
-    : numberOfCells(numberOfCells_)
+nel::HOGDescriptorCPP::HOGDescriptorCPP( int numberOfCells_, int numberOfBins_, bool gauss_, bool spinterp_, bool _signed_
+                                       , HOGNormalization normalization_, bool vectorized_, bool specialized_, bool ordered_
+                                       )
+    : m_lookupTable(_signed_      )
+    , numberOfCells(numberOfCells_)
     , numberOfBins (numberOfBins_ )
     , gauss        (gauss_        )
     , spinterp     (spinterp_     )
     , _signed      (_signed_      )
+    , normalization(normalization_)
+    , vectorized   (vectorized_   )
+    , specialized  (specialized_  )
+    , ordered      (ordered_      )
 {
     assert(numberOfCells > 1 || !spinterp);
-    m_lookupTable.resize(512 * 512);
-    for (int mdy = -255; mdy < 256; ++mdy)
-        for (int mdx = -255; mdx < 256; ++mdx) {
-            m_lookupTable[(mdy + 255) * 512 + mdx + 255].first = get_orientation(mdy,mdx);
-            m_lookupTable[(mdy + 255) * 512 + mdx + 255].second = std::hypot(mdx, mdy);
-        }
 }
 
 int nel::HOGDescriptorCPP::getNumberOfBins() const {
     return numberOfCells * numberOfCells * numberOfBins;
 }
 
-float nel::HOGDescriptorCPP::get_orientation(float mdy, float mdx) const {
-    if (_signed) {
-        return std::atan2(mdy, mdx) / static_cast<float>(M_PI) / 2.0f;
-    } else {
-        return std::atan2(mdy, mdx) / static_cast<float>(M_PI) + 0.5f;
-    }
+template <typename Gradients>
+void nel::HOGDescriptorCPP::computeLocations( const Gradients         &gradients
+                                            , const cv::Mat_<uint8_t> &image
+                                            , const cv::Mat_<float>   &locations
+                                            , const cv::Mat_<float>   &blocksizes
+                                            , const std::vector<int>  &order
+                                            , cv::Mat                 &descriptors
+                                            , HOGOutputFormat         format
+                                            ) const
+{
+    //The common configurations are compiled with constant cells, bins and flags, the others use the runtime values
+    if (specialized && ( computeSpecialized<1, 8>(gradients, image, locations, blocksizes, order, descriptors, format)
+                      || computeSpecialized<1, 9>(gradients, image, locations, blocksizes, order, descriptors, format)
+                      || computeSpecialized<2, 9>(gradients, image, locations, blocksizes, order, descriptors, format)
+                      || computeSpecialized<4, 8>(gradients, image, locations, blocksizes, order, descriptors, format)
+                       ))
+        return;
+
+    const RuntimeConfig config = { numberOfCells, numberOfBins, gauss, spinterp };
+    computeLocations(config, gradients, image, locations, blocksizes, order, descriptors, format);
 }
 
-cv::Mat_<float> nel::HOGDescriptorCPP::compute( const cv::Mat_<uint8_t>  &image
-                                              , const cv::Mat_<float> &locations
-                                              , const cv::Mat_<float> &blocksizes
+template <int Cells, int Bins, typename Gradients>
+bool nel::HOGDescriptorCPP::computeSpecialized( const Gradients         &gradients
+                                              , const cv::Mat_<uint8_t> &image
+                                              , const cv::Mat_<float>   &locations
+                                              , const cv::Mat_<float>   &blocksizes
+                                              , const std::vector<int>  &order
+                                              , cv::Mat                 &descriptors
+                                              , HOGOutputFormat         format
                                               ) const
 {
-    assert(2 == locations.cols);
-    assert(2 == blocksizes.cols);
-    cv::Mat_<float> descriptors(locations.rows, getNumberOfBins(), 0.0f);
-
-#ifdef WITH_TBB
-    tbb::parallel_for(tbb::blocked_range<size_t>(0, locations.rows, 5), [&](const tbb::blocked_range<size_t> range) {
-    for (size_t n = range.begin(); n != range.end(); ++n) {
-#else
-    for (size_t n = 0; n < (size_t)locations.rows; ++n) {
-#endif
+    if (numberOfCells != Cells || numberOfBins != Bins)
+        return false;
+
+    if (gauss && spinterp)
+        computeLocations(FixedConfig<Cells, Bins, true , true >(), gradients, image, locations, blocksizes, order, descriptors, format);
+    else if (gauss)
+        computeLocations(FixedConfig<Cells, Bins, true , false>(), gradients, image, locations, blocksizes, order, descriptors, format);
+    else if (spinterp)
+        computeLocations(FixedConfig<Cells, Bins, false, true >(), gradients, image, locations, blocksizes, order, descriptors, format);
+    else
+        computeLocations(FixedConfig<Cells, Bins, false, false>(), gradients, image, locations, blocksizes, order, descriptors, format);
+    return true;
+}
 
+template <typename Config, typename Gradients>
+void nel::HOGDescriptorCPP::computeLocations( const Config            &config
+                                            , const Gradients         &gradients
+                                            , const cv::Mat_<uint8_t> &image
+                                            , const cv::Mat_<float>   &locations
+                                            , const cv::Mat_<float>   &blocksizes
+                                            , const std::vector<int>  &order
+                                            , cv::Mat                 &descriptors
+                                            , HOGOutputFormat         format
+                                            ) const
+{
+    //Constants of the specialized configurations, the members otherwise
+    const int  numberOfCells = config.numberOfCells;
+    const int  numberOfBins  = config.numberOfBins;
+    const bool gauss         = config.gauss;
+    const bool spinterp      = config.spinterp;
+
+    //Writes the histogram of the rows [firstRow, endRow) of the block of location n to out
+    const auto accumulate = [&](const size_t n, const int firstRow, const int endRow, BlockScratch &scratch, float out[]) {
         const float &blocksizeX = blocksizes(n,0);
         const float &blocksizeY = blocksizes(n,1);
         const float centerx = locations(n, 0);
@@ -130,27 +328,55 @@ cv::Mat_<float> nel::HOGDescriptorCPP::compute( const cv::Mat_<uint8_t>  &image
 
         const float minx = centerx - halfblocksizeX;
         const float miny = centery - halfblocksizeY;
-        const float maxx = centerx + halfblocksizeX;
-        const float maxy = centery + halfblocksizeY;
-        
-        const int minxi = std::max(fast_ceil(minx) , 1);
-        const int minyi = std::max(fast_ceil(miny) , 1);
-        const int maxxi = std::min(fast_floor(maxx), image.cols - 2);
-        const int maxyi = std::min(fast_floor(maxy), image.rows - 2);
-
-        cv::Mat_<float> hist(numberOfCells * numberOfCells, numberOfBins, 0.0f);
-
-        float m1p2sigmaX2;
-        float m1p2sigmaY2;
+
+        cv::Rect footprint = block_footprint(image.rows, image.cols, centerx, centery, blocksizeX, blocksizeY);
+        footprint.height = std::max(std::min(footprint.y + footprint.height, endRow) - std::max(footprint.y, firstRow), 0);
+        footprint.y = std::max(footprint.y, firstRow);
+        const int minxi = footprint.x;
+        const int minyi = footprint.y;
+        const int maxxi = footprint.x + footprint.width - 1;
+        const int maxyi = footprint.y + footprint.height - 1;
+
+        std::vector<float> &weightsX = scratch.weightsX;
+        std::vector<float> &weightsY = scratch.weightsY;
         if (gauss) {
             float sigmaX = halfblocksizeX;
             float sigmaY = halfblocksizeY;
             float sigmaX2 = sigmaX*sigmaX;
             float sigmaY2 = sigmaY*sigmaY;
-            m1p2sigmaX2 = -1.0f/(2.0f*sigmaX2);
-            m1p2sigmaY2 = -1.0f/(2.0f*sigmaY2);
+            float m1p2sigmaX2 = -1.0f/(2.0f*sigmaX2);
+            float m1p2sigmaY2 = -1.0f/(2.0f*sigmaY2);
             //float A = 1.0f / (2 * (float)M_PI*sigma2); // constant multiplier to all bin elements, but we normalize at the end, so we can skip this
+
+            //exp(dx2 * m1p2sigmaX2 + dy2 * m1p2sigmaY2) = exp(dx2 * m1p2sigmaX2) * exp(dy2 * m1p2sigmaY2): one weight per column and one per row
+            weightsX.resize(std::max(footprint.width, 0));
+            for (int pointx = minxi; pointx <= maxxi; pointx++) {
+                float dx = pointx - centerx;
+                weightsX[pointx - minxi] = std::exp(dx * dx * m1p2sigmaX2);
+            }
+            weightsY.resize(std::max(footprint.height, 0));
+            for (int pointy = minyi; pointy <= maxyi; pointy++) {
+                float dy = pointy - centery;
+                weightsY[pointy - minyi] = std::exp(dy * dy * m1p2sigmaY2);
+            }
+        }
+
+#ifdef HOG_SIMD
+        if (vectorized) {
+            //The last vector of a row reads past the last column
+            if (gauss)
+                weightsX.resize(weightsX.size() + nel::simd::PIXELS - 1, 0.0f);
+            scratch.block.resize(nel::simd::block_scratch_size(config));
+            nel::simd::accumulate_block( config, gradients, footprint, minx, miny, cellsizeX, cellsizeY
+                                       , gauss ? weightsX.data() : nullptr, gauss ? weightsY.data() : nullptr
+                                       , scratch.block.data(), out);
+            return;
         }
+#endif
+
+        //Cell x bin histogram, directly in out
+        std::fill(out, out + numberOfCells * numberOfCells * numberOfBins, 0.0f);
+        const auto hist = [&](const int cell, const int bin) -> float & { return out[cell * numberOfBins + bin]; };
 
         // compute edges, magnitudes, orientations and the histogram
         for (int pointy = minyi; pointy <= maxyi; pointy++) {
@@ -169,25 +395,16 @@ cv::Mat_<float> nel::HOGDescriptorCPP::compute( const cv::Mat_<uint8_t>  &image
                 yscale0 = 1.0f - yscale1;
             }
 
-            float dy2;
-            if (gauss) {
-                float dy = pointy - centery;
-                dy2 = dy*dy;
-            }
+            float weightY;
+            if (gauss)
+                weightY = weightsY[pointy - minyi];
 
             for (int pointx = minxi; pointx <= maxxi; pointx++) {
-                int mdxi = image(pointy, pointx + 1) - image(pointy, pointx - 1);
-                int mdyi = image(pointy + 1, pointx) - image(pointy - 1, pointx);
+                float magnitude, orientation;
+                gradients(pointy, pointx, magnitude, orientation);
 
-                float magnitude = m_lookupTable[(mdyi + 255) * 512 + mdxi + 255].second;
-                float orientation = m_lookupTable[(mdyi + 255) * 512 + mdxi + 255].first;
-
-                if (gauss) {
-                    float dx = pointx - centerx;
-                    float dx2 = dx*dx;
-                    float B = std::exp(dx2 * m1p2sigmaX2 + dy2 * m1p2sigmaY2);
-                    magnitude *= B;
-                }
+                if (gauss)
+                    magnitude *= weightY * weightsX[pointx - minxi];
 
                 // linear/trilinear interpolation of magnitudes
                 float relative_orientation = orientation * numberOfBins - 0.5f;
@@ -241,18 +458,447 @@ cv::Mat_<float> nel::HOGDescriptorCPP::compute( const cv::Mat_<uint8_t>  &image
             }
             #pragma GCC diagnostic pop
         }
-        cv::Mat_<float> destRow = descriptors.row(n);
-        hist.reshape(0,1).copyTo(destRow);
+    };
+
+    //Float descriptors are accumulated in their rows, the other formats in a float histogram quantized once it is normalized
+    const auto store = [&](const size_t n, float hist[]) {
+        normalize_descriptor(hist, descriptors.cols, normalization);
+        quantize_descriptor(hist, descriptors.cols, format, descriptors.ptr(n));
+    };
+
+#ifdef WITH_TBB
+    //The work of a location is about the area of its footprint. The locations are cut into runs of about PARTITION_COST
+    //pixels on the prefix sums of their areas, and the blocks above twice that into row strips of about PARTITION_COST
+    //pixels, whose histograms are added to the descriptor afterwards, so a few large blocks do not finish last alone.
+    struct WorkItem {
+        size_t begin, end;          // locations of order, or the location of a strip
+        int firstRow, endRow;       // rows of a strip
+        int strip;                  // row of the strip in partials, -1 for the runs of locations
+    };
+    std::vector<cv::Rect> footprints(order.size());
+    std::vector<double> cost(order.size() + 1, 0.0);
+    std::vector<WorkItem> items;
+    std::vector<std::pair<size_t, int> > split;        // location of order and first strip of the split blocks
+    int strips = 0;
+    for (size_t k = 0; k < order.size(); ++k) {
+        const int n = order[k];
+        footprints[k] = block_footprint(image.rows, image.cols, locations(n, 0), locations(n, 1), blocksizes(n, 0), blocksizes(n, 1));
+        if (footprints[k].area() > 2 * PARTITION_COST) {
+            split.push_back(std::make_pair(k, strips));
+            const int rows = std::max(PARTITION_COST / footprints[k].width, 1);
+            const int endRow = footprints[k].y + footprints[k].height;
+            for (int row = footprints[k].y; row < endRow; row += rows) {
+                const WorkItem strip = { k, k + 1, row, std::min(row + rows, endRow), strips++ };
+                items.push_back(strip);
+            }
+            cost[k + 1] = cost[k];
+        } else {
+            cost[k + 1] = cost[k] + footprints[k].area() + LOCATION_COST;
+        }
+    }
+    for (size_t begin = 0; begin < order.size(); ) {
+        //Up to the last location within PARTITION_COST pixels of the first one, at least one
+        const size_t end = std::max<size_t>(std::upper_bound(cost.begin() + begin + 1, cost.end(), cost[begin] + PARTITION_COST) - cost.begin() - 1, begin + 1);
+        const WorkItem run = { begin, end, 0, 0, -1 };
+        items.push_back(run);
+        begin = end;
+    }
+
+    cv::Mat_<float> partials(strips, descriptors.cols, 0.0f);
+    tbb::enumerable_thread_specific<BlockScratch> scratches;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, items.size(), 1), [&](const tbb::blocked_range<size_t> range) {
+        BlockScratch &blockScratch = scratches.local();
+        blockScratch.descriptor.resize(descriptors.cols);
+        for (size_t i = range.begin(); i != range.end(); ++i) {
+            const WorkItem &item = items[i];
+            if (item.strip >= 0) {
+                accumulate(order[item.begin], item.firstRow, item.endRow, blockScratch, partials[item.strip]);
+                continue;
+            }
+            for (size_t k = item.begin; k != item.end; ++k)
+                if (footprints[k].area() <= 2 * PARTITION_COST) {
+                    float *hist = OUTPUT_FLOAT32 == format ? descriptors.ptr<float>(order[k]) : blockScratch.descriptor.data();
+                    accumulate(order[k], 0, image.rows, blockScratch, hist);
+                    store(order[k], hist);
+                }
+        }
+    });
+
+    //Sum of the strips of the split blocks, in their first strip
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, split.size(), 1), [&](const tbb::blocked_range<size_t> range) {
+        for (size_t i = range.begin(); i != range.end(); ++i) {
+            const int endStrip = i + 1 < split.size() ? split[i + 1].second : strips;
+            float *hist = partials[split[i].second];
+            for (int strip = split[i].second + 1; strip < endStrip; ++strip)
+                for (int bin = 0; bin < descriptors.cols; ++bin)
+                    hist[bin] += partials(strip, bin);
+            store(order[split[i].first], hist);
+        }
+    });
+#else
+    BlockScratch blockScratch;
+    blockScratch.descriptor.resize(descriptors.cols);
+    for (size_t k = 0; k < order.size(); ++k) {
+        float *hist = OUTPUT_FLOAT32 == format ? descriptors.ptr<float>(order[k]) : blockScratch.descriptor.data();
+        accumulate(order[k], 0, image.rows, blockScratch, hist);
+        store(order[k], hist);
+    }
+#endif
+}
+
+void nel::HOGDescriptorCPP::computeIntegral( const HOGIntegralHistogram  &histograms
+                                           , const std::vector<cv::Rect> &footprints
+                                           , const cv::Mat_<float>       &locations
+                                           , const cv::Mat_<float>       &blocksizes
+                                           , const std::vector<int>      &order
+                                           , cv::Mat                     &descriptors
+                                           , HOGOutputFormat             format
+                                           ) const
+{
+    assert(!gauss && !spinterp);
+#ifdef WITH_TBB
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, locations.rows, 16), [&](const tbb::blocked_range<size_t> range) {
+    std::vector<float> scratch(descriptors.cols);
+    for (size_t k = range.begin(); k != range.end(); ++k) {
+#else
+    std::vector<float> scratch(descriptors.cols);
+    for (size_t k = 0; k < (size_t)locations.rows; ++k) {
+#endif
+        const size_t n = order[k];
+        const cv::Rect &footprint = footprints[n];
+        const float cellsizeX = blocksizes(n, 0) / numberOfCells;
+        const float cellsizeY = blocksizes(n, 1) / numberOfCells;
+        const float minx = locations(n, 0) - blocksizes(n, 0) / 2.0f;
+        const float miny = locations(n, 1) - blocksizes(n, 1) / 2.0f;
+        const int endx = footprint.x + footprint.width;
+        const int endy = footprint.y + footprint.height;
+
+        //Every cell is a rectangle of the footprint
+        float *hist = OUTPUT_FLOAT32 == format ? descriptors.ptr<float>(n) : scratch.data();
+        int celly0 = footprint.y;
+        for (int celly = 0; celly < numberOfCells; ++celly) {
+            const int celly1 = cell_start(footprint.y, endy, miny, cellsizeY, celly + 1);
+            int cellx0 = footprint.x;
+            for (int cellx = 0; cellx < numberOfCells; ++cellx) {
+                const int cellx1 = cell_start(footprint.x, endx, minx, cellsizeX, cellx + 1);
+                histograms(cellx0, celly0, cellx1, celly1, hist + (celly * numberOfCells + cellx) * numberOfBins);
+                cellx0 = cellx1;
+            }
+            celly0 = celly1;
+        }
+        normalize_descriptor(hist, descriptors.cols, normalization);
+        quantize_descriptor(hist, descriptors.cols, format, descriptors.ptr(n));
     }
 #ifdef WITH_TBB
     });
 #endif
+}
+
+cv::Mat_<float> nel::HOGDescriptorCPP::compute( const cv::Mat_<uint8_t>  &image
+                                              , const cv::Mat_<float> &locations
+                                              , const cv::Mat_<float> &blocksizes
+                                              , GradientMode           mode
+                                              ) const
+{
+    return computeAs(image, locations, blocksizes, OUTPUT_FLOAT32, mode);
+}
+
+cv::Mat nel::HOGDescriptorCPP::computeAs( const cv::Mat_<uint8_t> &image
+                                        , const cv::Mat_<float>   &locations
+                                        , const cv::Mat_<float>   &blocksizes
+                                        , HOGOutputFormat          format
+                                        , GradientMode             mode
+                                        ) const
+{
+    assert(2 == locations.cols);
+    assert(2 == blocksizes.cols);
+    if (OUTPUT_UINT8 == format && NORMALIZE_NONE == normalization)
+        throw std::runtime_error("The uint8 descriptors need a block normalization.");
+    cv::Mat descriptors = cv::Mat::zeros(locations.rows, getNumberOfBins(), output_type(format));
+
+    std::vector<cv::Rect> footprints(locations.rows);
+    double total_area = 0.0;
+    int minx = image.cols, miny = image.rows, maxx = 0, maxy = 0;
+    for (int n = 0; n < locations.rows; ++n) {
+        footprints[n] = block_footprint(image.rows, image.cols, locations(n, 0), locations(n, 1), blocksizes(n, 0), blocksizes(n, 1));
+        total_area += footprints[n].area();
+        if (footprints[n].area() > 0) {
+            minx = std::min(minx, footprints[n].x);
+            miny = std::min(miny, footprints[n].y);
+            maxx = std::max(maxx, footprints[n].x + footprints[n].width);
+            maxy = std::max(maxy, footprints[n].y + footprints[n].height);
+        }
+    }
+    const cv::Rect region(minx, miny, std::max(maxx - minx, 0), std::max(maxy - miny, 0));
+
+    //The locations are processed in the Morton order of the tiles of their footprint centers, so consecutive
+    //blocks, and the blocks given to a thread, read nearby pixels; the descriptors stay in the input order
+    std::vector<int> order(locations.rows);
+    std::iota(order.begin(), order.end(), 0);
+    if (ordered) {
+        std::vector<uint64_t> keys(locations.rows);
+        for (int n = 0; n < locations.rows; ++n)
+            keys[n] = morton_key( static_cast<uint32_t>(footprints[n].x + footprints[n].width  / 2) >> HOGGradientTiles::TILE_SHIFT
+                                , static_cast<uint32_t>(footprints[n].y + footprints[n].height / 2) >> HOGGradientTiles::TILE_SHIFT);
+        std::stable_sort(order.begin(), order.end(), [&](const int a, const int b) { return keys[a] < keys[b]; });
+    }
+
+    if (GRADIENTS_AUTO == mode) {
+        //Building the integral histograms costs about INTEGRAL_COST per-pixel gradient lookups for each pixel of the region,
+        //and their tables are bounded by INTEGRAL_MAX_BYTES; the shared gradients take 8 bytes per pixel
+        if (!gauss && !spinterp && total_area > INTEGRAL_COST * static_cast<double>(region.area())
+                                && HOGIntegralHistogram::bytes(region, numberOfBins) <= INTEGRAL_MAX_BYTES)
+            mode = GRADIENTS_INTEGRAL;
+        else
+            mode = total_area > static_cast<double>(image.rows) * image.cols ? GRADIENTS_SHARED : GRADIENTS_PER_PIXEL;
+    }
+
+    if (GRADIENTS_INTEGRAL == mode) {
+        if (gauss || spinterp)
+            throw std::runtime_error("The integral histograms do not support Gaussian weights or spatial interpolation.");
+        const HOGIntegralHistogram histograms(image, region, numberOfBins, m_lookupTable);
+        computeIntegral(histograms, footprints, locations, blocksizes, order, descriptors, format);
+    } else if (GRADIENTS_SHARED == mode) {
+        //The tiles are stored in the order the footprints first touch them
+        std::vector<cv::Rect> orderedFootprints(footprints.size());
+        for (size_t k = 0; k < footprints.size(); ++k)
+            orderedFootprints[k] = footprints[order[k]];
+        const HOGGradientTiles gradients(image, orderedFootprints, m_lookupTable);
+        computeLocations(gradients, image, locations, blocksizes, order, descriptors, format);
+    } else {
+        const PixelGradients gradients = { image, m_lookupTable };
+        computeLocations(gradients, image, locations, blocksizes, order, descriptors, format);
+    }
     return descriptors;
 }
 
-nel::HOGDescriptorOCL::HOGDescriptorOCL(int numberOfCells_, int numberOfBins_, bool gauss, bool spinterp, bool _signed)
+cv::Size nel::HOGDescriptorCPP::denseBlocks(const cv::Size &imagesize, const cv::Size &cellsize) const {
+    check_cell_size(cellsize);
+    //The central differences are defined in [1, cols - 2] x [1, rows - 2]
+    const int cellsX = std::max(imagesize.width  - 2, 0) / cellsize.width;
+    const int cellsY = std::max(imagesize.height - 2, 0) / cellsize.height;
+    return cv::Size(std::max(cellsX - numberOfCells + 1, 0), std::max(cellsY - numberOfCells + 1, 0));
+}
+
+void nel::HOGDescriptorCPP::denseLocations( const cv::Size  &imagesize
+                                          , const cv::Size  &cellsize
+                                          , cv::Mat_<float> &locations
+                                          , cv::Mat_<float> &blocksizes
+                                          ) const
+{
+    //The block edges are half a pixel before the first pixel of their cells, so compute() sees the same pixels and cells
+    const cv::Size blocks = denseBlocks(imagesize, cellsize);
+    locations.create(blocks.area(), 2);
+    blocksizes.create(blocks.area(), 2);
+    for (int by = 0; by < blocks.height; ++by)
+        for (int bx = 0; bx < blocks.width; ++bx) {
+            const int n = by * blocks.width + bx;
+            blocksizes(n, 0) = static_cast<float>(numberOfCells * cellsize.width);
+            blocksizes(n, 1) = static_cast<float>(numberOfCells * cellsize.height);
+            locations(n, 0) = 1 + bx * cellsize.width  - 0.5f + blocksizes(n, 0) / 2.0f;
+            locations(n, 1) = 1 + by * cellsize.height - 0.5f + blocksizes(n, 1) / 2.0f;
+        }
+}
+
+void nel::HOGDescriptorCPP::checkDenseGrid(const cv::Size &cellsize) const
+{
+    if (gauss || spinterp)
+        throw std::runtime_error("The dense grid does not support Gaussian weights or spatial interpolation.");
+    check_cell_size(cellsize);
+}
+
+void nel::HOGDescriptorCPP::computeCells(const cv::Mat_<uint8_t> &image, const cv::Size &cellsize, cv::Mat_<float> &cells) const
+{
+    checkDenseGrid(cellsize);
+
+    const int cellsX = std::max(image.cols - 2, 0) / cellsize.width;
+    const int cellsY = std::max(image.rows - 2, 0) / cellsize.height;
+    cells.create(cellsY, cellsX * numberOfBins);
+    cells = 0.0f;
+    const PixelGradients gradients = { image, m_lookupTable };
+
+    //Rows of DENSE_TILE_CELLS cells
+    const int tileRows = (cellsY + DENSE_TILE_CELLS - 1) / DENSE_TILE_CELLS;
+#ifdef WITH_TBB
+    tbb::parallel_for(tbb::blocked_range<int>(0, tileRows), [&](const tbb::blocked_range<int> range) {
+    for (int tiley = range.begin(); tiley != range.end(); ++tiley) {
+#else
+    for (int tiley = 0; tiley < tileRows; ++tiley) {
+#endif
+        const int celly0 = tiley * DENSE_TILE_CELLS;
+        const int celly1 = std::min(celly0 + DENSE_TILE_CELLS, cellsY);
+
+#ifdef HOG_SIMD
+        if (vectorized) {
+            //Every tile of DENSE_TILE_CELLS x DENSE_TILE_CELLS cells is a block without weights
+            const RuntimeConfig config = { DENSE_TILE_CELLS, numberOfBins, false, false };
+            std::vector<float> hist(DENSE_TILE_CELLS * DENSE_TILE_CELLS * numberOfBins);
+            std::vector<float> scratch(nel::simd::block_scratch_size(config));
+            for (int cellx0 = 0; cellx0 < cellsX; cellx0 += DENSE_TILE_CELLS) {
+                const int cellx1 = std::min(cellx0 + DENSE_TILE_CELLS, cellsX);
+                const cv::Rect footprint( 1 + cellx0 * cellsize.width, 1 + celly0 * cellsize.height
+                                        , (cellx1 - cellx0) * cellsize.width, (celly1 - celly0) * cellsize.height);
+                nel::simd::accumulate_block( config, gradients, footprint, footprint.x - 0.5f, footprint.y - 0.5f
+                                           , static_cast<float>(cellsize.width), static_cast<float>(cellsize.height)
+                                           , nullptr, nullptr, scratch.data(), hist.data());
+                for (int celly = celly0; celly < celly1; ++celly)
+                    std::copy_n( &hist[(celly - celly0) * DENSE_TILE_CELLS * numberOfBins]
+                               , (cellx1 - cellx0) * numberOfBins, cells[celly] + cellx0 * numberOfBins);
+            }
+            continue;
+        }
+#endif
+
+        //The pixels of every cell in the order of computeLocations
+        for (int celly = celly0; celly < celly1; ++celly) {
+            float *hist = cells[celly];
+            for (int pointy = 1 + celly * cellsize.height; pointy < 1 + (celly + 1) * cellsize.height; ++pointy)
+                for (int cellx = 0; cellx < cellsX; ++cellx) {
+                    float *cell = hist + cellx * numberOfBins;
+                    for (int pointx = 1 + cellx * cellsize.width; pointx < 1 + (cellx + 1) * cellsize.width; ++pointx) {
+                        float magnitude, orientation;
+                        gradients(pointy, pointx, magnitude, orientation);
+
+                        float relative_orientation = orientation * numberOfBins - 0.5f;
+                        int bin1 = fast_ceil(relative_orientation);
+                        int bin0 = bin1 - 1;
+                        float magscale0 = magnitude * (bin1 - relative_orientation);
+                        float magscale1 = magnitude * (relative_orientation - bin0);
+                        cell[(bin0 + numberOfBins) % numberOfBins] += magscale0;
+                        cell[(bin1 + numberOfBins) % numberOfBins] += magscale1;
+                    }
+                }
+        }
+    }
+#ifdef WITH_TBB
+    });
+#endif
+}
+
+cv::Mat_<float> nel::HOGDescriptorCPP::computeDense(const cv::Mat_<uint8_t> &image, const cv::Size &cellsize) const
+{
+    cv::Mat_<float> cells;
+    computeCells(image, cellsize, cells);
+
+    const cv::Size blocks = denseBlocks(image.size(), cellsize);
+    const int blockRow = numberOfCells * numberOfBins;     // the cells of a block row are contiguous in the grid
+    cv::Mat_<float> descriptors(blocks.area(), getNumberOfBins());
+#ifdef WITH_TBB
+    tbb::parallel_for(tbb::blocked_range<int>(0, blocks.height), [&](const tbb::blocked_range<int> range) {
+    for (int by = range.begin(); by != range.end(); ++by) {
+#else
+    for (int by = 0; by < blocks.height; ++by) {
+#endif
+        for (int bx = 0; bx < blocks.width; ++bx) {
+            float *hist = descriptors[by * blocks.width + bx];
+            for (int celly = 0; celly < numberOfCells; ++celly)
+                std::copy_n(cells[by + celly] + bx * numberOfBins, blockRow, hist + celly * blockRow);
+            normalize_descriptor(hist, descriptors.cols, normalization);
+        }
+    }
+#ifdef WITH_TBB
+    });
+#endif
+    return descriptors;
+}
+
+cv::Mat_<float> nel::HOGDescriptorCPP::detectDense( const cv::Mat_<uint8_t> &image
+                                                  , const cv::Size          &cellsize
+                                                  , const cv::Size          &window
+                                                  , const cv::Mat_<float>   &weights
+                                                  , float                    bias
+                                                  ) const
+{
+    checkDenseGrid(cellsize);
+    const int blockBins = getNumberOfBins();
+    if (window.width <= 0 || window.height <= 0 || !weights.isContinuous() || weights.total() != static_cast<size_t>(window.area()) * blockBins)
+        throw std::runtime_error("The classifier weights do not match the detection window.");
+
+    const cv::Size blocks = denseBlocks(image.size(), cellsize);
+    const cv::Size windows(std::max(blocks.width - window.width + 1, 0), std::max(blocks.height - window.height + 1, 0));
+    cv::Mat_<float> scores(windows, bias);
+    //No window fits in the image, the block rows below would be past the cells
+    if (scores.empty())
+        return scores;
+
+    cv::Mat_<float> cells;
+    computeCells(image, cellsize, cells);
+
+    const int blockRow = numberOfCells * numberOfBins;
+    const float *blockWeights = weights[0];
+    //Every block row is normalized once for a range of window rows and added to the windows of the range that contain it
+#ifdef WITH_TBB
+    tbb::parallel_for(tbb::blocked_range<int>(0, windows.height, 16), [&](const tbb::blocked_range<int> range) {
+    const int y0 = range.begin();
+    const int y1 = range.end();
+#else
+    {
+    const int y0 = 0;
+    const int y1 = windows.height;
+#endif
+        std::vector<float> normalized(NORMALIZE_NONE != normalization ? blocks.width * blockBins : 0);
+        for (int blocky = y0; blocky < y1 + window.height - 1; ++blocky) {
+            //The cell rows of the blocks: in the grid without normalization, normalized in a copy otherwise
+            const float *blockRows = cells[blocky];
+            size_t step = cells.step1();
+            size_t blockStep = numberOfBins;
+            if (NORMALIZE_NONE != normalization) {
+                for (int blockx = 0; blockx < blocks.width; ++blockx) {
+                    float *hist = &normalized[blockx * blockBins];
+                    for (int celly = 0; celly < numberOfCells; ++celly)
+                        std::copy_n(cells[blocky + celly] + blockx * numberOfBins, blockRow, hist + celly * blockRow);
+                    normalize_descriptor(hist, blockBins, normalization);
+                }
+                blockRows = normalized.data();
+                step = blockRow;
+                blockStep = blockBins;
+            }
+
+            //The block (blocky, blockx) is the block (by, bx) of the window (blocky - by, blockx - bx)
+            for (int by = std::max(blocky - y1 + 1, 0); by <= std::min(blocky - y0, window.height - 1); ++by) {
+                float *score = scores[blocky - by];
+                for (int blockx = 0; blockx < blocks.width; ++blockx) {
+                    const float *block = blockRows + blockx * blockStep;
+                    for (int bx = std::max(blockx - windows.width + 1, 0); bx <= std::min(blockx, window.width - 1); ++bx) {
+                        const float *w = blockWeights + (by * window.width + bx) * blockBins;
+                        float sum = 0.0f;
+                        for (int celly = 0; celly < numberOfCells; ++celly)
+                            sum += dot(block + celly * step, w + celly * blockRow, blockRow);
+                        score[blockx - bx] += sum;
+                    }
+                }
+            }
+        }
+#ifdef WITH_TBB
+    });
+#else
+    }
+#endif
+    return scores;
+}
+
+std::vector<cv::Mat_<float> > nel::HOGDescriptorCPP::computePyramid( const cv::Mat_<uint8_t>             &image
+                                                                   , const std::vector<float>            &scales
+                                                                   , const std::vector<cv::Mat_<float> > &locations
+                                                                   , const std::vector<cv::Mat_<float> > &blocksizes
+                                                                   , GradientMode                         mode
+                                                                   ) const
+{
+    if (locations.size() != scales.size() || blocksizes.size() != scales.size())
+        throw std::runtime_error("The pyramid needs the locations and block sizes of every level.");
+
+    std::vector<cv::Mat_<float> > levels(scales.size());
+    nel::for_each_pyramid_level(image, scales, [&](const size_t i, const cv::Mat_<uint8_t> &scaled) {
+        levels[i] = compute(scaled, locations[i], blocksizes[i], mode);
+    });
+    return levels;
+}
+
+nel::HOGDescriptorOCL::HOGDescriptorOCL(int numberOfCells_, int numberOfBins_, bool gauss_, bool spinterp, bool _signed, HOGNormalization normalization_)
     : numberOfCells(numberOfCells_)
     , numberOfBins(numberOfBins_)
+    , gauss(gauss_)
+    , normalization(normalization_)
 {
     assert(numberOfCells > 1 || !spinterp);
 
@@ -287,6 +933,8 @@ nel::HOGDescriptorOCL::HOGDescriptorOCL(int numberOfCells_, int numberOfBins_, b
     build_opts << " -D GAUSSIAN_WEIGHTS=" << (gauss    ? "1" : "0");
     build_opts << " -D SPARTIAL_WEIGHTS=" << (spinterp ? "1" : "0");
     build_opts << " -D SIGNED_HOG="       << (_signed  ? "1" : "0");
+    build_opts << " -D NORMALIZATION="    << static_cast<int>(normalization);
+    build_opts << " -D L2HYS_THRESHOLD="  << L2HYS_THRESHOLD << "f";
     if (!has_local_memory)
         build_opts << " -D DISABLE_LOCAL";
     try {
@@ -305,6 +953,11 @@ nel::HOGDescriptorOCL::HOGDescriptorOCL(int numberOfCells_, int numberOfBins_, b
     calc_hog_preferred_multiple = calc_hog.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device);
     calc_hog_group_size         = calc_hog.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
 
+    if (NORMALIZE_NONE != normalization) {
+        normalize_hog = cl::Kernel(program, "normalize_hog");
+        normalize_hog_preferred_multiple = normalize_hog.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device);
+    }
+
 #ifndef CL_VERSION_1_2
     fill_zeros = cl::Kernel(program, "fill_zeros");
     fill_zeros_preferred_multiple = fill_zeros.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device);
@@ -334,7 +987,7 @@ cv::Mat_<float> nel::HOGDescriptorOCL::compute( const cv::Mat_<uint8_t> &image
     assert(descriptors.isContinuous());
     
     //Events to track execution time
-    cl::Event start, end;
+    cl::Event start, end, normalized;
 
     //OPENCL START
     //Allocate OpenCL buffers
@@ -403,9 +1056,24 @@ cv::Mat_<float> nel::HOGDescriptorOCL::compute( const cv::Mat_<uint8_t> &image
             calc_hog.setArg(7, descriptor_cl());
             if (has_local_memory)
                 calc_hog.setArg(8, (size_t)(sizeof(cl_float) * getNumberOfBins() * lws_z), nullptr);
+            if (has_local_memory && gauss)
+                calc_hog.setArg(9, (size_t)(sizeof(cl_float) * (lws_x + lws_y) * lws_z), nullptr);
             queue.enqueueNDRangeKernel(calc_hog, cl::NullRange, global_work_size, local_work_size, nullptr, &end );
         }
     }
+
+    if (NORMALIZE_NONE != normalization) {
+        //The blocks are spread over several work groups, every descriptor is complete only after calc_hog:
+        //one work item per descriptor normalizes it in private memory before the read back
+        cl::NDRange  local_work_size(normalize_hog_preferred_multiple);
+        cl::NDRange global_work_size( round_to_multiple(num_locations, normalize_hog_preferred_multiple) );
+        {
+            //ADD MULTITHREAD LOCK HERE (if needed)
+            normalize_hog.setArg(0, (cl_int)num_locations);
+            normalize_hog.setArg(1, descriptor_cl());
+            queue.enqueueNDRangeKernel(normalize_hog, cl::NullRange, global_work_size, local_work_size, nullptr, &normalized );
+        }
+    }
     
     //Read result buffer from device
     queue.enqueueReadBuffer(descriptor_cl, CL_TRUE, 0, descriptor_bytes, descriptors.data);
@@ -414,21 +1082,83 @@ cv::Mat_<float> nel::HOGDescriptorOCL::compute( const cv::Mat_<uint8_t> &image
     double kernel_ns = end.getProfilingInfo<CL_PROFILING_COMMAND_END>() - start.getProfilingInfo<CL_PROFILING_COMMAND_START>();
     double kernel_ms = kernel_ns * 1e-6;
     std::cout << "calc_hog execution time: " << std::fixed << std::setprecision(6) << std::setw(8) << kernel_ms << " ms\n";
+    if (NORMALIZE_NONE != normalization) {
+        double normalize_ns = normalized.getProfilingInfo<CL_PROFILING_COMMAND_END>() - normalized.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+        double normalize_ms = normalize_ns * 1e-6;
+        std::cout << "normalize_hog execution time: " << std::fixed << std::setprecision(6) << std::setw(8) << normalize_ms << " ms\n";
+    }
 
-    //Normalize result
-//    for (int n = 0; n < num_locations; ++n) {
-//        float scale = static_cast<float>(cv::norm(descriptors.row(n), cv::NORM_L2));
-//        if (scale < std::numeric_limits<float>::epsilon())
-//            descriptors.row(n)= 0.0f;
-//        else {
-//            auto scaled = descriptors.row(n)/scale;
-//            scaled = cv::min(scaled, 0.3f);
-//            cv::normalize(scaled, descriptors.row(n));
-//        }
-//    }
     return descriptors;
 }
 
+void time_gradient_lookup( const std::vector<carp::record_t>& pool, int repeat )
+{
+    carp::Timing timing("HOG gradient lookup");
+
+    for (;repeat>0; --repeat) {
+        for ( auto & item : pool ) {
+            //The lookup table is shared, only the first construction builds it
+            const auto construct_start = std::chrono::high_resolution_clock::now();
+            nel::HOGDescriptorCPP descriptor( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG );
+            const auto construct_end = std::chrono::high_resolution_clock::now();
+            timing.print( "CPU descriptor construction", construct_end - construct_start );
+
+            const cv::Mat_<uint8_t> image = item.grayimg();
+            const nel::HOGGradientLookup lookup(SIGNED_HOG);
+
+            float sum = 0.0f;
+            const auto lookup_start = std::chrono::high_resolution_clock::now();
+            for (int y = 1; y < image.rows - 1; ++y)
+                for (int x = 1; x < image.cols - 1; ++x) {
+                    float magnitude, orientation;
+                    lookup(image(y + 1, x) - image(y - 1, x), image(y, x + 1) - image(y, x - 1), magnitude, orientation);
+                    sum += magnitude * orientation;
+                }
+            const auto lookup_end = std::chrono::high_resolution_clock::now();
+            timing.print( "CPU gradient lookup", lookup_end - lookup_start );
+
+            // Verifying the results: the reflected octants may differ from atan2 in the last bit
+            float max_error = 0.0f;
+            for (int mdy = -255; mdy < 256; ++mdy)
+                for (int mdx = -255; mdx < 256; ++mdx) {
+                    float magnitude, orientation;
+                    lookup(mdy, mdx, magnitude, orientation);
+                    const float expected = SIGNED_HOG ? std::atan2(static_cast<float>(mdy), static_cast<float>(mdx)) / static_cast<float>(M_PI) / 2.0f
+                                                      : std::atan2(static_cast<float>(mdy), static_cast<float>(mdx)) / static_cast<float>(M_PI) + 0.5f;
+                    if (magnitude != static_cast<float>(std::hypot(mdx, mdy)))
+                        throw std::runtime_error("The gradient lookup magnitudes are not equivalent with hypot.");
+                    max_error = std::max(max_error, std::abs(orientation - expected));
+                }
+            if (max_error > 1e-6f || !std::isfinite(sum))
+                throw std::runtime_error("The gradient lookup orientations are not equivalent with atan2.");
+        }
+    }
+}
+
+// Separate normalization pass over the rows of descriptors, as done after compute without fused normalization.
+void normalize_descriptors( cv::Mat_<float> &descriptors, nel::HOGNormalization normalization )
+{
+    for (int n = 0; n < descriptors.rows; ++n) {
+        cv::Mat_<float> row = descriptors.row(n);
+        switch (normalization) {
+        case nel::NORMALIZE_NONE:
+            break;
+        case nel::NORMALIZE_L2:
+            cv::normalize(row, row, 1.0, 0.0, cv::NORM_L2);
+            break;
+        case nel::NORMALIZE_L2HYS:
+            cv::normalize(row, row, 1.0, 0.0, cv::NORM_L2);
+            cv::min(row, nel::L2HYS_THRESHOLD, row);
+            cv::normalize(row, row, 1.0, 0.0, cv::NORM_L2);
+            break;
+        case nel::NORMALIZE_L1SQRT:
+            cv::normalize(row, row, 1.0, 0.0, cv::NORM_L1);
+            cv::sqrt(row, row);
+            break;
+        }
+    }
+}
+
 void time_hog( const std::vector<carp::record_t>& pool, const std::vector<float>& sizes, int num_positions, int repeat )
 {
     carp::Timing timing("HOG");
@@ -442,8 +1172,11 @@ void time_hog( const std::vector<carp::record_t>& pool, const std::vector<float>
             for ( auto & item : pool ) {
                 std::mt19937 rng(1);   //uses same seed, reseed for all iteration
 
-                cv::Mat cpu_gray;
-                cv::cvtColor( item.cpuimg(), cpu_gray, CV_RGB2GRAY );
+                // decoding straight to grayscale, the decoder skips the color conversion
+                const auto decode_start = std::chrono::high_resolution_clock::now();
+                cv::Mat cpu_gray = item.grayimg();
+                const auto decode_end = std::chrono::high_resolution_clock::now();
+                timing.print( "decode (gray)", decode_end - decode_start );
                 std::cout << "image path: " << item.path()   << std::endl;
                 std::cout << "image rows: " << cpu_gray.rows << std::endl;
                 std::cout << "image cols: " << cpu_gray.cols << std::endl;
@@ -463,6 +1196,9 @@ void time_hog( const std::vector<carp::record_t>& pool, const std::vector<float>
                 }
 
                 cv::Mat_<float> cpu_result, gpu_result, pen_result;
+#ifndef RUN_ONLY_ONE_EXPERIMENT
+                cv::Mat_<float> cpu_normalized, gpu_normalized, pen_normalized;   //L2-Hys
+#endif
                 std::chrono::duration<double> elapsed_time_cpu, elapsed_time_gpu;
 
                 {
@@ -478,6 +1214,125 @@ void time_hog( const std::vector<carp::record_t>& pool, const std::vector<float>
                     const auto cpu_end = std::chrono::high_resolution_clock::now();
 
                     elapsed_time_cpu = cpu_end - cpu_start;
+
+#ifndef RUN_ONLY_ONE_EXPERIMENT
+                    //The variants below are compared and timed in the full benchmark only, the tuning runs time the default ones
+
+                    //Both gradient modes, the automatic choice above is one of them unless it took the integral histograms
+                    const auto per_pixel_start = std::chrono::high_resolution_clock::now();
+                    cv::Mat_<float> per_pixel_result = descriptor.compute(cpu_gray, locations, blocksizes, nel::HOGDescriptorCPP::GRADIENTS_PER_PIXEL);
+                    const auto per_pixel_end = std::chrono::high_resolution_clock::now();
+                    cv::Mat_<float> shared_result = descriptor.compute(cpu_gray, locations, blocksizes, nel::HOGDescriptorCPP::GRADIENTS_SHARED);
+                    const auto shared_end = std::chrono::high_resolution_clock::now();
+
+                    if ( cv::norm( shared_result, per_pixel_result, cv::NORM_INF ) != 0 )
+                        throw std::runtime_error("The shared gradients are not equivalent with the per-pixel gradients.");
+                    if ( cv::norm( cpu_result, per_pixel_result, cv::NORM_INF ) > cv::norm( per_pixel_result, cv::NORM_INF )*1e-5 )
+                        throw std::runtime_error("The automatic gradient mode is not equivalent with the per-pixel gradients.");
+                    timing.print( "CPU per-pixel gradients", per_pixel_end - per_pixel_start );
+                    timing.print( "CPU shared gradients", shared_end - per_pixel_end );
+
+                    //Vectorized (the default above) against scalar histograms, for this configuration and for spatially interpolated cells
+                    static nel::HOGDescriptorCPP scalar( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG, nel::NORMALIZE_NONE, false );
+                    static nel::HOGDescriptorCPP interpolated( 4, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, true, SIGNED_HOG );
+                    static nel::HOGDescriptorCPP interpolated_scalar( 4, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, true, SIGNED_HOG, nel::NORMALIZE_NONE, false );
+                    const auto scalar_start = std::chrono::high_resolution_clock::now();
+                    cv::Mat_<float> scalar_result = scalar.compute(cpu_gray, locations, blocksizes, nel::HOGDescriptorCPP::GRADIENTS_PER_PIXEL);
+                    const auto scalar_end = std::chrono::high_resolution_clock::now();
+                    cv::Mat_<float> interpolated_result = interpolated.compute(cpu_gray, locations, blocksizes, nel::HOGDescriptorCPP::GRADIENTS_PER_PIXEL);
+                    const auto interpolated_end = std::chrono::high_resolution_clock::now();
+                    cv::Mat_<float> interpolated_scalar_result = interpolated_scalar.compute(cpu_gray, locations, blocksizes, nel::HOGDescriptorCPP::GRADIENTS_PER_PIXEL);
+                    const auto interpolated_scalar_end = std::chrono::high_resolution_clock::now();
+
+                    if ( cv::norm( per_pixel_result, scalar_result, cv::NORM_INF ) > cv::norm( scalar_result, cv::NORM_INF )*1e-5 )
+                        throw std::runtime_error("The vectorized histograms are not equivalent with the scalar histograms.");
+                    if ( cv::norm( interpolated_result, interpolated_scalar_result, cv::NORM_INF ) > cv::norm( interpolated_scalar_result, cv::NORM_INF )*1e-5 )
+                        throw std::runtime_error("The vectorized interpolated histograms are not equivalent with the scalar histograms.");
+                    timing.print( "CPU scalar per-pixel", scalar_end - scalar_start );
+                    timing.print( "CPU interpolated 4x4 vectorized", interpolated_end - scalar_end );
+                    timing.print( "CPU interpolated 4x4 scalar", interpolated_scalar_end - interpolated_end );
+
+                    //Runtime configuration against the specialized code of the common configurations
+                    static nel::HOGDescriptorCPP generic( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG, nel::NORMALIZE_NONE, true, false );
+                    static nel::HOGDescriptorCPP generic_scalar( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG, nel::NORMALIZE_NONE, false, false );
+                    const auto generic_start = std::chrono::high_resolution_clock::now();
+                    cv::Mat_<float> generic_result = generic.compute(cpu_gray, locations, blocksizes, nel::HOGDescriptorCPP::GRADIENTS_PER_PIXEL);
+                    const auto generic_end = std::chrono::high_resolution_clock::now();
+                    cv::Mat_<float> generic_scalar_result = generic_scalar.compute(cpu_gray, locations, blocksizes, nel::HOGDescriptorCPP::GRADIENTS_PER_PIXEL);
+                    const auto generic_scalar_end = std::chrono::high_resolution_clock::now();
+
+                    if ( cv::norm( per_pixel_result, generic_result, cv::NORM_INF ) > cv::norm( generic_result, cv::NORM_INF )*1e-5 )
+                        throw std::runtime_error("The specialized histograms are not equivalent with the generic histograms.");
+                    if ( cv::norm( scalar_result, generic_scalar_result, cv::NORM_INF ) > cv::norm( generic_scalar_result, cv::NORM_INF )*1e-5 )
+                        throw std::runtime_error("The specialized scalar histograms are not equivalent with the generic scalar histograms.");
+                    timing.print( "CPU generic per-pixel", generic_end - generic_start );
+                    timing.print( "CPU generic scalar per-pixel", generic_scalar_end - generic_end );
+
+                    //Locations in the input order against the Morton order (the default above), the descriptors are the same
+                    static nel::HOGDescriptorCPP unordered( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG, nel::NORMALIZE_NONE, true, true, false );
+                    const auto unordered_start = std::chrono::high_resolution_clock::now();
+                    cv::Mat_<float> unordered_result = unordered.compute(cpu_gray, locations, blocksizes);
+                    const auto unordered_end = std::chrono::high_resolution_clock::now();
+
+                    if ( cv::norm( cpu_result, unordered_result, cv::NORM_INF ) != 0 )
+                        throw std::runtime_error("The Morton ordered locations are not equivalent with the input order.");
+                    timing.print( "CPU unordered locations", unordered_end - unordered_start );
+
+                    //Integral histograms, with the unweighted configuration they support
+                    static nel::HOGDescriptorCPP unweighted( NUMBER_OF_CELLS, NUMBER_OF_BINS, false, false, SIGNED_HOG );
+                    const auto unweighted_start = std::chrono::high_resolution_clock::now();
+                    cv::Mat_<float> unweighted_result = unweighted.compute(cpu_gray, locations, blocksizes, nel::HOGDescriptorCPP::GRADIENTS_PER_PIXEL);
+                    const auto unweighted_end = std::chrono::high_resolution_clock::now();
+                    cv::Mat_<float> integral_result = unweighted.compute(cpu_gray, locations, blocksizes, nel::HOGDescriptorCPP::GRADIENTS_INTEGRAL);
+                    const auto integral_end = std::chrono::high_resolution_clock::now();
+
+                    //The per-pixel code sums in float, the integral histograms in double
+                    if ( cv::norm( integral_result, unweighted_result, cv::NORM_INF ) > cv::norm( unweighted_result, cv::NORM_INF )*1e-5 )
+                        throw std::runtime_error("The integral histograms are not equivalent with the per-pixel histograms.");
+                    timing.print( "CPU unweighted per-pixel", unweighted_end - unweighted_start );
+                    timing.print( "CPU unweighted integral", integral_end - unweighted_end );
+
+                    //Fused block normalization against compute followed by a separate cv::normalize pass
+                    const nel::HOGNormalization normalizations[] = { nel::NORMALIZE_L2, nel::NORMALIZE_L2HYS, nel::NORMALIZE_L1SQRT };
+                    const std::string normalization_names[] = { "L2", "L2-Hys", "L1-sqrt" };
+                    for (int i = 0; i < 3; ++i) {
+                        const nel::HOGDescriptorCPP normalized( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG, normalizations[i] );
+                        const auto fused_start = std::chrono::high_resolution_clock::now();
+                        cv::Mat_<float> fused_result = normalized.compute(cpu_gray, locations, blocksizes);
+                        const auto fused_end = std::chrono::high_resolution_clock::now();
+                        cv::Mat_<float> separate_result = descriptor.compute(cpu_gray, locations, blocksizes);
+                        normalize_descriptors(separate_result, normalizations[i]);
+                        const auto separate_end = std::chrono::high_resolution_clock::now();
+
+                        if ( cv::norm( fused_result, separate_result, cv::NORM_INF ) > cv::norm( separate_result, cv::NORM_INF )*1e-5 )
+                            throw std::runtime_error("The fused " + normalization_names[i] + " normalization is not equivalent with cv::normalize.");
+                        timing.print( "CPU fused " + normalization_names[i], fused_end - fused_start );
+                        timing.print( "CPU separate " + normalization_names[i], separate_end - fused_end );
+                        if (nel::NORMALIZE_L2HYS == normalizations[i])
+                            cpu_normalized = fused_result;
+                    }
+
+                    //Quantized output written from the accumulation stage, against the float L2-Hys descriptors
+                    static nel::HOGDescriptorCPP quantized( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG, nel::NORMALIZE_L2HYS );
+                    const nel::HOGOutputFormat formats[] = { nel::OUTPUT_FLOAT32, nel::OUTPUT_FLOAT16, nel::OUTPUT_BFLOAT16, nel::OUTPUT_UINT8 };
+                    const std::string format_names[] = { "float32", "fp16", "bfloat16", "uint8" };
+                    const double max_errors[] = { 0.0, 1.0 / 1024, 1.0 / 128, 0.5 / 255 };
+                    for (int i = 0; i < 4; ++i) {
+                        const auto quantized_start = std::chrono::high_resolution_clock::now();
+                        cv::Mat quantized_result = quantized.computeAs(cpu_gray, locations, blocksizes, formats[i]);
+                        const auto quantized_end = std::chrono::high_resolution_clock::now();
+
+                        //The bins of the L2-Hys descriptors are in [0, 1], so the rounding errors are bounded in absolute terms
+                        const double error = cv::norm( nel::dequantize_descriptors(quantized_result, formats[i]), cpu_normalized, cv::NORM_INF );
+                        if ( error > max_errors[i] + 1e-6 )
+                            throw std::runtime_error("The " + format_names[i] + " descriptors are not equivalent with the float descriptors.");
+                        const double bytes = static_cast<double>(quantized_result.rows) * quantized_result.cols * quantized_result.elemSize();
+                        const double seconds = std::chrono::duration<double>(quantized_end - quantized_start).count();
+                        timing.print( "CPU fused L2-Hys " + format_names[i], quantized_end - quantized_start );
+                        std::cout << "output " << format_names[i] << ": " << std::fixed << std::setprecision(1) << bytes / (1 << 20) << " MiB, "
+                                  << bytes / seconds / (1 << 30) << " GiB/s, relative error " << std::scientific << std::setprecision(2) << error / cv::norm( cpu_normalized, cv::NORM_INF ) << std::endl;
+                    }
+#endif
                     //Free up resources
                 }
                 {
@@ -501,6 +1356,15 @@ void time_hog( const std::vector<carp::record_t>& pool, const std::vector<float>
                     const auto gpu_end = std::chrono::high_resolution_clock::now();
 
                     elapsed_time_gpu = gpu_end - gpu_start;
+
+#ifndef RUN_ONLY_ONE_EXPERIMENT
+                    //Normalization by the normalize_hog kernel, before the read back
+                    static nel::HOGDescriptorOCL normalized( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG, nel::NORMALIZE_L2HYS );
+                    const auto gpu_normalized_start = std::chrono::high_resolution_clock::now();
+                    gpu_normalized = normalized.compute(cpu_gray, locations, blocksizes, max_blocksize_x, max_blocksize_y);
+                    const auto gpu_normalized_end = std::chrono::high_resolution_clock::now();
+                    timing.print( "GPU fused L2-Hys", gpu_normalized_end - gpu_normalized_start );
+#endif
                     //Free up resources
                 }
 #ifndef EXCLUDE_PENCIL_TEST
@@ -510,7 +1374,7 @@ void time_hog( const std::vector<carp::record_t>& pool, const std::vector<float>
 
                     if (first_execution_pencil)
                     {
-                        pencil_hog( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG
+                        pencil_hog( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG, nel::NORMALIZE_NONE
                               , cpu_gray.rows, cpu_gray.cols, cpu_gray.step1(), cpu_gray.ptr<uint8_t>()
                               , num_positions
                               , reinterpret_cast<const float (*)[2]>(locations.data)
@@ -523,7 +1387,7 @@ void time_hog( const std::vector<carp::record_t>& pool, const std::vector<float>
                     prl_timings_reset();
                     prl_timings_start();
 
-                    pencil_hog( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG
+                    pencil_hog( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG, nel::NORMALIZE_NONE
                               , cpu_gray.rows, cpu_gray.cols, cpu_gray.step1(), cpu_gray.ptr<uint8_t>()
                               , num_positions
                               , reinterpret_cast<const float (*)[2]>(locations.data)
@@ -534,6 +1398,17 @@ void time_hog( const std::vector<carp::record_t>& pool, const std::vector<float>
                     prl_timings_stop();
                     // Dump execution times for PENCIL code.
                     prl_timings_dump();
+
+#ifndef RUN_ONLY_ONE_EXPERIMENT
+                    pen_normalized.create(num_positions, NUMBER_OF_CELLS * NUMBER_OF_CELLS * NUMBER_OF_BINS);
+                    pencil_hog( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG, nel::NORMALIZE_L2HYS
+                              , cpu_gray.rows, cpu_gray.cols, cpu_gray.step1(), cpu_gray.ptr<uint8_t>()
+                              , num_positions
+                              , reinterpret_cast<const float (*)[2]>(locations.data)
+                              , reinterpret_cast<const float (*)[2]>(blocksizes.data)
+                              , reinterpret_cast<      float  *    >(pen_normalized.data)
+                              );
+#endif
                 }
 #endif
                 // Verifying the results
@@ -548,6 +1423,10 @@ void time_hog( const std::vector<carp::record_t>& pool, const std::vector<float>
                     cv::imwrite( "hog_diff_cpu_gpu.png", cv::abs(cpu_result-gpu_result) );
                     throw std::runtime_error("The OpenCL results are not equivalent with the C++ results.");
                 }
+#ifndef RUN_ONLY_ONE_EXPERIMENT
+                if ( cv::norm( cpu_normalized, gpu_normalized, cv::NORM_INF) > cv::norm( cpu_normalized, cv::NORM_INF)*1e-5 )
+                    throw std::runtime_error("The OpenCL normalized results are not equivalent with the C++ results.");
+#endif
 #ifndef EXCLUDE_PENCIL_TEST
                 if ( cv::norm( cpu_result, pen_result, cv::NORM_INF) > cv::norm( cpu_result, cv::NORM_INF)*1e-5 )
                 {
@@ -560,6 +1439,10 @@ void time_hog( const std::vector<carp::record_t>& pool, const std::vector<float>
                     cv::imwrite( "hog_diff_cpu_pen.png", cv::abs(cpu_result-pen_result) );
                     throw std::runtime_error("The PENCIL results are not equivalent with the C++ results.");
                 }
+#ifndef RUN_ONLY_ONE_EXPERIMENT
+                if ( cv::norm( cpu_normalized, pen_normalized, cv::NORM_INF) > cv::norm( cpu_normalized, cv::NORM_INF)*1e-5 )
+                    throw std::runtime_error("The PENCIL normalized results are not equivalent with the C++ results.");
+#endif
 #endif
                 timing.print(elapsed_time_cpu, elapsed_time_gpu);
             }
@@ -567,6 +1450,167 @@ void time_hog( const std::vector<carp::record_t>& pool, const std::vector<float>
     }
 }
 
+// Scores of the windows of window.width x window.height blocks from a materialized matrix of the dense block descriptors
+cv::Mat_<float> score_windows( const cv::Mat_<float> &descriptors
+                             , const cv::Size        &blocks
+                             , const cv::Size        &window
+                             , const cv::Mat_<float> &weights
+                             , float                  bias
+                             )
+{
+    const cv::Size windows(std::max(blocks.width - window.width + 1, 0), std::max(blocks.height - window.height + 1, 0));
+    cv::Mat_<float> scores(windows, bias);
+    for (int y = 0; y < windows.height; ++y)
+        for (int x = 0; x < windows.width; ++x)
+            for (int by = 0; by < window.height; ++by)
+                for (int bx = 0; bx < window.width; ++bx)
+                    scores(y, x) += descriptors.row((y + by) * blocks.width + x + bx).dot(weights.colRange((by * window.width + bx) * descriptors.cols, (by * window.width + bx + 1) * descriptors.cols));
+    return scores;
+}
+
+void time_dense( const std::vector<carp::record_t>& pool, int repeat )
+{
+    carp::Timing timing("HOG dense detection");
+
+    //Dalal-Triggs: 8x8 cells, 2x2 cell blocks at every cell, 64x128 windows of 7x15 blocks
+    const cv::Size cellsize(8, 8);
+    const cv::Size window(7, 15);
+    const nel::HOGDescriptorCPP descriptor( 2, 9, false, false, SIGNED_HOG, nel::NORMALIZE_L2HYS );
+    const nel::HOGDescriptorCPP scalar    ( 2, 9, false, false, SIGNED_HOG, nel::NORMALIZE_L2HYS, false );
+
+    std::mt19937 rng(1);
+    std::normal_distribution<float> distribution(0.0f, 0.1f);
+    cv::Mat_<float> weights(1, window.area() * descriptor.getNumberOfBins());
+    for (float &w : weights)
+        w = distribution(rng);
+    const float bias = -0.5f;
+
+    //Images with fewer block rows or columns than a window have no window to score
+    const cv::Mat_<uint8_t> short_image(100, 200, uint8_t(128));
+    const cv::Mat_<uint8_t> narrow_image(200, 40, uint8_t(128));
+    if ( !descriptor.detectDense(short_image, cellsize, window, weights, bias).empty()
+      || !scalar.detectDense(short_image, cellsize, window, weights, bias).empty()
+      || !descriptor.detectDense(narrow_image, cellsize, window, weights, bias).empty() )
+        throw std::runtime_error("The dense detection scores windows larger than the image.");
+    //Invalid grids are rejected whatever the image size
+    const nel::HOGDescriptorCPP weighted( 2, 9, true, false, SIGNED_HOG, nel::NORMALIZE_L2HYS );
+    const auto rejected = [&](const nel::HOGDescriptorCPP &hog, const cv::Size &size) {
+        try {
+            hog.detectDense(short_image, size, window, weights, bias);
+        } catch (const std::runtime_error &) {
+            return true;
+        }
+        return false;
+    };
+    if (!rejected(weighted, cellsize) || !rejected(descriptor, cv::Size(0, 8)) || !rejected(descriptor, cv::Size(8, -1)))
+        throw std::runtime_error("The dense detection accepts an invalid grid.");
+
+    for (;repeat>0; --repeat) {
+        for ( auto & item : pool ) {
+            const cv::Mat_<uint8_t> image = item.grayimg();
+            const cv::Size blocks = descriptor.denseBlocks(image.size(), cellsize);
+            std::cout << "image path: " << item.path() << std::endl;
+            std::cout << "dense blocks: " << blocks.width << "x" << blocks.height << std::endl;
+
+            const auto dense_start = std::chrono::high_resolution_clock::now();
+            const cv::Mat_<float> scores = descriptor.detectDense(image, cellsize, window, weights, bias);
+            const auto dense_end = std::chrono::high_resolution_clock::now();
+            timing.print( "CPU dense detection", dense_end - dense_start );
+
+            const auto scalar_start = std::chrono::high_resolution_clock::now();
+            const cv::Mat_<float> scalar_scores = scalar.detectDense(image, cellsize, window, weights, bias);
+            const auto scalar_end = std::chrono::high_resolution_clock::now();
+            timing.print( "CPU dense scalar detection", scalar_end - scalar_start );
+
+            //Every block computed on its own by compute(), then the windows scored from the block matrix
+            cv::Mat_<float> locations, blocksizes;
+            descriptor.denseLocations(image.size(), cellsize, locations, blocksizes);
+            const auto blocks_start = std::chrono::high_resolution_clock::now();
+            const cv::Mat_<float> block_descriptors = descriptor.compute(image, locations, blocksizes);
+            const cv::Mat_<float> block_scores = score_windows(block_descriptors, blocks, window, weights, bias);
+            const auto blocks_end = std::chrono::high_resolution_clock::now();
+            timing.print( "CPU per-block detection", blocks_end - blocks_start );
+
+            const double num_windows = static_cast<double>(scores.total());
+            const auto windows_per_second = [num_windows](const std::chrono::duration<double> &time) { return num_windows / time.count(); };
+            std::cout << std::fixed << std::setprecision(0);
+            std::cout << "windows: " << scores.cols << "x" << scores.rows << std::endl;
+            std::cout << "CPU dense detection        : " << windows_per_second(dense_end - dense_start) << " windows/s" << std::endl;
+            std::cout << "CPU dense scalar detection : " << windows_per_second(scalar_end - scalar_start) << " windows/s" << std::endl;
+            std::cout << "CPU per-block detection    : " << windows_per_second(blocks_end - blocks_start) << " windows/s" << std::endl;
+
+            // Verifying the results
+            if ( cv::norm( descriptor.computeDense(image, cellsize), block_descriptors, cv::NORM_INF ) > 1e-5 )
+                throw std::runtime_error("The dense block descriptors are not equivalent with the per-location ones.");
+            if ( cv::norm( scores, block_scores, cv::NORM_INF ) > cv::norm( block_scores, cv::NORM_INF )*1e-5
+              || cv::norm( scalar_scores, block_scores, cv::NORM_INF ) > cv::norm( block_scores, cv::NORM_INF )*1e-5 )
+                throw std::runtime_error("The dense detection scores are not equivalent with the per-block ones.");
+        }
+    }
+}
+
+void time_pyramid( const std::vector<carp::record_t>& pool, int repeat )
+{
+    carp::Timing timing("HOG pyramid");
+
+    //15 levels from the full image to a quarter of it, one block every half block on each level
+    std::vector<float> scales;
+    for (int i = 0; i < 15; ++i)
+        scales.push_back(std::pow(0.9f, static_cast<float>(i)));
+    const float size = BLOCK_SIZE;
+    const float stride = BLOCK_SIZE / 2;
+
+    const nel::HOGDescriptorCPP descriptor( NUMBER_OF_CELLS, NUMBER_OF_BINS, GAUSSIAN_WEIGHTS, SPARTIAL_WEIGHTS, SIGNED_HOG );
+
+    for (;repeat>0; --repeat) {
+        for ( auto & item : pool ) {
+            const cv::Mat_<uint8_t> image = item.grayimg();
+            std::cout << "image path: " << item.path() << std::endl;
+
+            std::vector<cv::Mat_<float> > locations(scales.size()), blocksizes(scales.size());
+            size_t num_locations = 0;
+            for (size_t i = 0; i < scales.size(); ++i) {
+                const cv::Size level = nel::pyramid_level_size(image.size(), scales[i]);
+                const int countX = std::max(static_cast<int>((level.width  - 2 - size) / stride) + 1, 0);
+                const int countY = std::max(static_cast<int>((level.height - 2 - size) / stride) + 1, 0);
+                locations[i].create(countX * countY, 2);
+                blocksizes[i].create(countX * countY, 2);
+                for (int y = 0; y < countY; ++y)
+                    for (int x = 0; x < countX; ++x) {
+                        //The block edges half a pixel before the first pixel, as the dense blocks
+                        locations[i](y * countX + x, 0) = 1 + x * stride - 0.5f + size / 2;
+                        locations[i](y * countX + x, 1) = 1 + y * stride - 0.5f + size / 2;
+                        blocksizes[i](y * countX + x, 0) = size;
+                        blocksizes[i](y * countX + x, 1) = size;
+                    }
+                num_locations += countX * countY;
+            }
+            std::cout << "pyramid levels: " << scales.size() << ", locations: " << num_locations << std::endl;
+
+            //Resize and compute one level after the other
+            std::vector<cv::Mat_<float> > serial(scales.size());
+            const auto serial_start = std::chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < scales.size(); ++i) {
+                cv::Mat_<uint8_t> scaled;
+                cv::resize(image, scaled, nel::pyramid_level_size(image.size(), scales[i]), 0, 0, cv::INTER_LINEAR);
+                serial[i] = descriptor.compute(scaled, locations[i], blocksizes[i]);
+            }
+            const auto serial_end = std::chrono::high_resolution_clock::now();
+            timing.print( "CPU serial pyramid", serial_end - serial_start );
+
+            const auto pyramid_start = std::chrono::high_resolution_clock::now();
+            const std::vector<cv::Mat_<float> > levels = descriptor.computePyramid(image, scales, locations, blocksizes);
+            const auto pyramid_end = std::chrono::high_resolution_clock::now();
+            timing.print( "CPU parallel pyramid", pyramid_end - pyramid_start );
+
+            // Verifying the results
+            for (size_t i = 0; i < scales.size(); ++i)
+                if ( cv::norm( levels[i], serial[i], cv::NORM_INF ) > cv::norm( serial[i], cv::NORM_INF )*1e-5 )
+                    throw std::runtime_error("The pyramid levels are not equivalent with the serial loop.");
+        }
+    }
+}
+
 int main(int argc, char* argv[])
 {
     try
@@ -579,7 +1623,10 @@ int main(int argc, char* argv[])
 #ifdef RUN_ONLY_ONE_EXPERIMENT
         time_hog( pool, {BLOCK_SIZE}, NUMBER_OF_LOCATIONS, 1 );
 #else
+        time_gradient_lookup( pool, 6 );
         time_hog( pool, {16, 32, 64, 128, 192}, NUMBER_OF_LOCATIONS, 6 );
+        time_dense( pool, 6 );
+        time_pyramid( pool, 6 );
 #endif
 
         prl_shutdown();
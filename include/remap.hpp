@@ -0,0 +1,256 @@
+// Precomputed remap tables for repeated geometric transforms
+//
+// A transform (affine warp, resize, ...) is compiled once into compact fixed-point
+// maps: per destination pixel the int16 top-left source coordinate and a uint8 index
+// into a table of quantized bilinear weights. The maps are stored tile by tile, so that
+// applying them walks the destination one cache-friendly tile at a time and is a pure
+// gather/blend pass without any coordinate arithmetic.
+
+#ifndef __CARP__REMAP__HPP__
+#define __CARP__REMAP__HPP__
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace carp {
+
+// Bilinear weights {w00, w01, w10, w11} for every quantized (row, col) fraction,
+// indexed by frac_r * TAB_SIZE + frac_c. w01 is the weight of the right neighbour.
+// The integer weights are exact and sum to TAB_SIZE * TAB_SIZE.
+template <int INTER_BITS>
+struct bilinear_tab {
+    enum { TAB_SIZE = 1 << INTER_BITS };
+
+    float w [TAB_SIZE * TAB_SIZE][4];
+    int   wi[TAB_SIZE * TAB_SIZE][4];
+
+    bilinear_tab() {
+        for ( int fr = 0; fr < TAB_SIZE; ++fr )
+            for ( int fc = 0; fc < TAB_SIZE; ++fc ) {
+                int * wi_ = wi[fr * TAB_SIZE + fc];
+                wi_[0] = (TAB_SIZE - fr) * (TAB_SIZE - fc);
+                wi_[1] = (TAB_SIZE - fr) * fc;
+                wi_[2] = fr * (TAB_SIZE - fc);
+                wi_[3] = fr * fc;
+                for ( int k = 0; k < 4; ++k )
+                    w[fr * TAB_SIZE + fc][k] = float(wi_[k]) / (TAB_SIZE * TAB_SIZE);
+            }
+    }
+
+    static const bilinear_tab & get() {
+        static const bilinear_tab tab;
+        return tab;
+    }
+};
+
+namespace remap {
+    enum {
+        INTER_BITS     = 4,                 // both fractions together fit in the uint8 weight index
+        INTER_TAB_SIZE = 1 << INTER_BITS,
+        TILE_COLS      = 64,
+        TILE_ROWS      = 16,
+        TILE_SIZE      = TILE_COLS * TILE_ROWS,
+    };
+
+    typedef bilinear_tab<INTER_BITS> tab_t;
+
+    // Quantizes one source coordinate to (top-left index, fraction) with a replicated border:
+    // outside the image both neighbours are the border pixel, which is the same as a zero fraction.
+    inline void quantize( const double v, const int size, int & idx, int & frac ) {
+        const double q = std::floor( v * INTER_TAB_SIZE + 0.5 );
+        if ( q < 0 ) {
+            idx = 0;
+            frac = 0;
+        } else if ( q >= double(size - 1) * INTER_TAB_SIZE ) {
+            idx = size - 1;
+            frac = 0;
+        } else {
+            const int qi = static_cast<int>(q);
+            idx  = qi >> INTER_BITS;
+            frac = qi & (INTER_TAB_SIZE - 1);
+        }
+    }
+}
+
+struct remap_maps {
+    int rows, cols;                 // destination size
+    int src_rows, src_cols;         // source size the maps were built for
+    int tiles_x, tiles_y;
+    std::vector<int16_t> xy;        // {col, row} of the top-left source pixel, tile-major
+    std::vector<uint8_t> widx;      // (frac_r << INTER_BITS) | frac_c
+
+    remap_maps() : rows(0), cols(0), src_rows(0), src_cols(0), tiles_x(0), tiles_y(0) {}
+
+    bool empty() const { return xy.empty(); }
+
+    // Offset of the map entry of destination pixel (r, c); tiles at the right and bottom are padded.
+    size_t offset( const int r, const int c ) const {
+        const int tx = c / remap::TILE_COLS;
+        const int ty = r / remap::TILE_ROWS;
+        return size_t(ty * tiles_x + tx) * remap::TILE_SIZE + (r % remap::TILE_ROWS) * remap::TILE_COLS + c % remap::TILE_COLS;
+    }
+
+    // coord(r, c, o_r, o_c) gives the source position of destination pixel (r, c).
+    template <typename Coord>
+    static remap_maps build( const int src_rows, const int src_cols, const int dst_rows, const int dst_cols, Coord coord ) {
+        if ( src_rows > std::numeric_limits<int16_t>::max() || src_cols > std::numeric_limits<int16_t>::max() )
+            throw std::runtime_error("remap_maps: the source image is too large for 16 bit coordinates.");
+
+        remap_maps m;
+        m.rows = dst_rows;
+        m.cols = dst_cols;
+        m.src_rows = src_rows;
+        m.src_cols = src_cols;
+        m.tiles_x = (dst_cols + remap::TILE_COLS - 1) / remap::TILE_COLS;
+        m.tiles_y = (dst_rows + remap::TILE_ROWS - 1) / remap::TILE_ROWS;
+        const size_t entries = size_t(m.tiles_x) * m.tiles_y * remap::TILE_SIZE;
+        m.xy.assign( 2 * entries, 0 );
+        m.widx.assign( entries, 0 );
+
+        for ( int r = 0; r < dst_rows; ++r )
+            for ( int c = 0; c < dst_cols; ++c ) {
+                double o_r, o_c;
+                coord( r, c, o_r, o_c );
+                int ir, fr, ic, fc;
+                remap::quantize( o_r, src_rows, ir, fr );
+                remap::quantize( o_c, src_cols, ic, fc );
+                const size_t o = m.offset(r, c);
+                m.xy[2 * o + 0] = static_cast<int16_t>(ic);
+                m.xy[2 * o + 1] = static_cast<int16_t>(ir);
+                m.widx[o] = static_cast<uint8_t>((fr << remap::INTER_BITS) | fc);
+            }
+        return m;
+    }
+
+    // Same coordinate convention and coefficients as pencil_affine_linear.
+    static remap_maps affine( const int src_rows, const int src_cols, const int dst_rows, const int dst_cols
+                            , const float a00, const float a01, const float a10, const float a11, const float b00, const float b10
+                            )
+    {
+        return build( src_rows, src_cols, dst_rows, dst_cols, [=]( int r, int c, double & o_r, double & o_c ) {
+            o_r = double(a11) * r + double(a10) * c + b00;
+            o_c = double(a01) * r + double(a00) * c + b10;
+        } );
+    }
+
+    // Pixel-center aligned bilinear resize, as pencil_resize_LN and cv::resize(INTER_LINEAR).
+    static remap_maps resize( const int src_rows, const int src_cols, const int dst_rows, const int dst_cols ) {
+        const double scale_r = double(src_rows) / dst_rows;
+        const double scale_c = double(src_cols) / dst_cols;
+        return build( src_rows, src_cols, dst_rows, dst_cols, [=]( int r, int c, double & o_r, double & o_c ) {
+            o_r = (r + 0.5) * scale_r - 0.5;
+            o_c = (c + 0.5) * scale_c - 0.5;
+        } );
+    }
+};
+
+namespace remap {
+    // Applies the maps to the destination pixels of one tile.
+    inline void apply_tile( const remap_maps & m, const int tx, const int ty
+                          , const int src_step, const float src[], const int dst_step, float dst[]
+                          )
+    {
+        const tab_t & tab = tab_t::get();
+        const int r_end = std::min( (ty + 1) * TILE_ROWS, m.rows );
+        const int c_begin = tx * TILE_COLS;
+        const int c_end = std::min( c_begin + TILE_COLS, m.cols );
+        const int last_r = m.src_rows - 1;
+        const int last_c = m.src_cols - 1;
+
+        for ( int r = ty * TILE_ROWS; r < r_end; ++r ) {
+            const size_t o = m.offset(r, c_begin);
+            const int16_t * xy = &m.xy[2 * o];
+            const uint8_t * widx = &m.widx[o];
+            float * dst_row = dst + size_t(r) * dst_step;
+            int c = c_begin;
+#if defined(__AVX2__)
+            const float * w = &tab.w[0][0];
+            const __m256i vlast_r = _mm256_set1_epi32(last_r);
+            const __m256i vlast_c = _mm256_set1_epi32(last_c);
+            const __m256i vone    = _mm256_set1_epi32(1);
+            const __m256i vstep   = _mm256_set1_epi32(src_step);
+            for ( ; c + 8 <= c_end; c += 8, xy += 16, widx += 8 ) {
+                const __m256i vxy = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xy));
+                const __m256i c0 = _mm256_srai_epi32(_mm256_slli_epi32(vxy, 16), 16);
+                const __m256i r0 = _mm256_srai_epi32(vxy, 16);
+                const __m256i c1 = _mm256_min_epi32(_mm256_add_epi32(c0, vone), vlast_c);
+                const __m256i r1 = _mm256_min_epi32(_mm256_add_epi32(r0, vone), vlast_r);
+                const __m256i row0 = _mm256_mullo_epi32(r0, vstep);
+                const __m256i row1 = _mm256_mullo_epi32(r1, vstep);
+
+                const __m256 A00 = _mm256_i32gather_ps(src, _mm256_add_epi32(row0, c0), 4);
+                const __m256 A01 = _mm256_i32gather_ps(src, _mm256_add_epi32(row0, c1), 4);
+                const __m256 A10 = _mm256_i32gather_ps(src, _mm256_add_epi32(row1, c0), 4);
+                const __m256 A11 = _mm256_i32gather_ps(src, _mm256_add_epi32(row1, c1), 4);
+
+                const __m256i vw = _mm256_slli_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(widx))), 2);
+                __m256 res = _mm256_mul_ps(_mm256_i32gather_ps(w + 0, vw, 4), A00);
+                res = _mm256_add_ps(res, _mm256_mul_ps(_mm256_i32gather_ps(w + 1, vw, 4), A01));
+                res = _mm256_add_ps(res, _mm256_mul_ps(_mm256_i32gather_ps(w + 2, vw, 4), A10));
+                res = _mm256_add_ps(res, _mm256_mul_ps(_mm256_i32gather_ps(w + 3, vw, 4), A11));
+                _mm256_storeu_ps(dst_row + c, res);
+            }
+#endif
+            for ( ; c < c_end; ++c, xy += 2, ++widx ) {
+                const int c0 = xy[0];
+                const int r0 = xy[1];
+                const int c1 = std::min(c0 + 1, last_c);
+                const int r1 = std::min(r0 + 1, last_r);
+                const float * w = tab.w[*widx];
+                dst_row[c] = w[0] * src[r0 * src_step + c0] + w[1] * src[r0 * src_step + c1]
+                           + w[2] * src[r1 * src_step + c0] + w[3] * src[r1 * src_step + c1];
+            }
+        }
+    }
+
+    inline void apply_tile( const remap_maps & m, const int tx, const int ty
+                          , const int src_step, const uint8_t src[], const int dst_step, uint8_t dst[]
+                          )
+    {
+        const tab_t & tab = tab_t::get();
+        const int r_end = std::min( (ty + 1) * TILE_ROWS, m.rows );
+        const int c_begin = tx * TILE_COLS;
+        const int c_end = std::min( c_begin + TILE_COLS, m.cols );
+        const int last_r = m.src_rows - 1;
+        const int last_c = m.src_cols - 1;
+        const int shift = 2 * INTER_BITS;
+
+        for ( int r = ty * TILE_ROWS; r < r_end; ++r ) {
+            const size_t o = m.offset(r, c_begin);
+            const int16_t * xy = &m.xy[2 * o];
+            const uint8_t * widx = &m.widx[o];
+            uint8_t * dst_row = dst + size_t(r) * dst_step;
+            for ( int c = c_begin; c < c_end; ++c, xy += 2, ++widx ) {
+                const int c0 = xy[0];
+                const int r0 = xy[1];
+                const int c1 = std::min(c0 + 1, last_c);
+                const int r1 = std::min(r0 + 1, last_r);
+                const int * w = tab.wi[*widx];
+                const int sum = w[0] * src[r0 * src_step + c0] + w[1] * src[r0 * src_step + c1]
+                              + w[2] * src[r1 * src_step + c0] + w[3] * src[r1 * src_step + c1];
+                dst_row[c] = static_cast<uint8_t>((sum + (1 << (shift - 1))) >> shift);
+            }
+        }
+    }
+}
+
+// Applies precomputed maps with bilinear interpolation; dst must have the size the maps were built for.
+template <typename T>
+void remap_linear( const remap_maps & m, const int src_step, const T src[], const int dst_step, T dst[] )
+{
+    for ( int ty = 0; ty < m.tiles_y; ++ty )
+        for ( int tx = 0; tx < m.tiles_x; ++tx )
+            remap::apply_tile( m, tx, ty, src_step, src, dst_step, dst );
+}
+
+} // namespace carp
+
+#endif
@@ -6,20 +6,33 @@
 
 #include <chrono>
 #include <string>
+#include <vector>
+#include <numeric>
+#include <utility>
 #include <iomanip>
 #include <iostream>
 #include <fstream>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 #include <stdexcept>
 
+#ifdef WITH_JPEG
+#include <cstdio>
+#include <csetjmp>
+extern "C" {
+#include <jpeglib.h>
+}
+#endif
+
 namespace carp {
 
 class Timing
 {
     std::vector<double> cpu_timings;
     std::vector<double> gpu_timings;
+    std::vector<std::pair<std::string, std::vector<double> > > named_timings;
 public:
     Timing(const std::string & name) {
         std::cout << "Measuring performance of " << name << std::endl;
@@ -36,13 +49,92 @@ public:
         gpu_timings.push_back(gpu.count());
     }
 
+    // Records an additional measurement (e.g. a CPU variant of a kernel) that is accumulated under its own name.
+    void print( const std::string &name, const std::chrono::duration<double,std::milli> &time ) {
+        std::cout << std::fixed << std::setprecision(6);
+        std::cout << std::setw(8) << time.count() << " ms - " << name << std::endl;
+
+        auto it = named_timings.begin();
+        while ( it != named_timings.end() && it->first != name )
+            ++it;
+        if ( it == named_timings.end() )
+            it = named_timings.insert( it, std::make_pair( name, std::vector<double>() ) );
+        it->second.push_back(time.count());
+    }
+
     ~Timing() {
         std::cout << std::endl << "OpenCV accumulated time measurements for all the experiments (in ms):" << std::endl;
-        std::cout<<"[RealEyes] Accumulate CPU time           : "<< std::accumulate(cpu_timings.begin(),cpu_timings.end(),0.0) << "\n";
-        std::cout<<"[RealEyes] Accumulate GPU time (inc copy): "<< std::accumulate(gpu_timings.begin(),gpu_timings.end(),0.0) << "\n";
+        // the tuning scripts take the median of these lines, so timings without an OpenCV CPU/GPU pair do not print them
+        if ( !cpu_timings.empty() ) {
+            std::cout<<"[RealEyes] Accumulate CPU time           : "<< std::accumulate(cpu_timings.begin(),cpu_timings.end(),0.0) << "\n";
+            std::cout<<"[RealEyes] Accumulate GPU time (inc copy): "<< std::accumulate(gpu_timings.begin(),gpu_timings.end(),0.0) << "\n";
+        }
+        for ( auto & named : named_timings )
+            std::cout<<"[RealEyes] Accumulate "<< named.first << " time: "<< std::accumulate(named.second.begin(),named.second.end(),0.0) << "\n";
     }
 };
 
+#ifdef WITH_JPEG
+namespace detail {
+
+    struct jpeg_error_manager {
+        jpeg_error_mgr pub;
+        std::jmp_buf jump;
+    };
+
+    inline void jpeg_error_exit( j_common_ptr cinfo ) {
+        std::longjmp( reinterpret_cast<jpeg_error_manager*>(cinfo->err)->jump, 1 );
+    }
+
+    // Decodes only the luminance of a JPEG file, scaled by 1/scale_denom in the DCT domain.
+    // Returns false if the file is not a JPEG that libjpeg can decode this way.
+    inline bool decode_jpeg_gray( const char * path, const int scale_denom, cv::Mat & result ) {
+        std::FILE * const file = std::fopen( path, "rb" );
+        if (!file)
+            return false;
+        unsigned char magic[2] = { 0, 0 };
+        if ( std::fread( magic, 1, 2, file ) != 2 || magic[0] != 0xFF || magic[1] != 0xD8 ) {
+            std::fclose(file);
+            return false;
+        }
+        std::rewind(file);
+
+        jpeg_decompress_struct cinfo;
+        jpeg_error_manager error;
+        cinfo.err = jpeg_std_error( &error.pub );
+        error.pub.error_exit = jpeg_error_exit;
+        if ( setjmp(error.jump) ) {
+            jpeg_destroy_decompress( &cinfo );
+            std::fclose(file);
+            return false;
+        }
+        jpeg_create_decompress( &cinfo );
+        jpeg_stdio_src( &cinfo, file );
+        jpeg_read_header( &cinfo, TRUE );
+        if ( cinfo.jpeg_color_space != JCS_YCbCr && cinfo.jpeg_color_space != JCS_GRAYSCALE ) {
+            jpeg_destroy_decompress( &cinfo );
+            std::fclose(file);
+            return false;
+        }
+        cinfo.out_color_space = JCS_GRAYSCALE;
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = scale_denom;
+        jpeg_start_decompress( &cinfo );
+
+        result.create( cinfo.output_height, cinfo.output_width, CV_8UC1 );
+        while ( cinfo.output_scanline < cinfo.output_height ) {
+            JSAMPROW row = result.ptr<uchar>( cinfo.output_scanline );
+            jpeg_read_scanlines( &cinfo, &row, 1 );
+        }
+        jpeg_finish_decompress( &cinfo );
+        jpeg_destroy_decompress( &cinfo );
+        std::fclose(file);
+        return true;
+    }
+
+} // namespace detail
+#endif
+
 class record_t {
 private:
     char *m_path;
@@ -52,6 +144,26 @@ public:
         return cv::imread(m_path);
     }
 
+    // Decodes straight to 8-bit grayscale, skipping the color conversion of the decoder.
+    // scale_denom (1, 2, 4 or 8) shrinks the image while decoding when the kernel downsizes anyway:
+    // with libjpeg (WITH_JPEG) JPEG files are scaled in the DCT domain, otherwise the decoded image is resized.
+    cv::Mat grayimg( int scale_denom = 1 ) const {
+        if ( scale_denom != 1 && scale_denom != 2 && scale_denom != 4 && scale_denom != 8 )
+            throw std::runtime_error("The decode scale denominator has to be 1, 2, 4 or 8.");
+        cv::Mat result;
+#ifdef WITH_JPEG
+        if ( detail::decode_jpeg_gray( m_path, scale_denom, result ) )
+            return result;
+#endif
+        result = cv::imread( m_path, cv::IMREAD_GRAYSCALE );
+        if ( scale_denom != 1 && !result.empty() ) {
+            // same output size as libjpeg's scaled decoding
+            const cv::Size size( (result.cols + scale_denom - 1) / scale_denom, (result.rows + scale_denom - 1) / scale_denom );
+            cv::resize( result, result, size, 0, 0, cv::INTER_AREA );
+        }
+        return result;
+    }
+
     std::string path() const {
         return std::string(m_path);
     }
@@ -0,0 +1,137 @@
+#include "integral.pencil.h"
+#include <pencil.h>
+
+// Both kernels compute the prefix sums along every row (independent rows), then accumulate
+// the rows from the top (independent columns).
+
+static void integral_32( const int rows
+                       , const int cols
+                       , const int src_step
+                       , const int sum_step
+                       , const int sqsum_step
+                       , const uint8_t src[static const restrict rows][src_step]
+                       , int32_t sum[static const restrict rows + 1][sum_step]
+                       , double sqsum[static const restrict rows + 1][sqsum_step]
+                       )
+{
+#pragma scop
+    __pencil_assume(rows       >  0);
+    __pencil_assume(cols       >  0);
+    __pencil_assume(src_step   >= cols);
+    __pencil_assume(sum_step   >  cols);
+    __pencil_assume(sqsum_step >  cols);
+
+    __pencil_kill(sum);
+    __pencil_kill(sqsum);
+
+    #pragma pencil independent
+    for ( int c = 0; c <= cols; c++ )
+    {
+        sum[0][c] = 0;
+        sqsum[0][c] = 0;
+    }
+
+    #pragma pencil independent
+    for ( int r = 0; r < rows; r++ )
+    {
+        sum[r + 1][0] = 0;
+        sqsum[r + 1][0] = 0;
+        for ( int c = 0; c < cols; c++ )
+        {
+            const int pixel = src[r][c];
+            sum[r + 1][c + 1] = sum[r + 1][c] + pixel;
+            sqsum[r + 1][c + 1] = sqsum[r + 1][c] + pixel * pixel;
+        }
+    }
+
+    for ( int r = 1; r < rows; r++ )
+    {
+        #pragma pencil independent
+        for ( int c = 1; c <= cols; c++ )
+        {
+            sum[r + 1][c] += sum[r][c];
+            sqsum[r + 1][c] += sqsum[r][c];
+        }
+    }
+    __pencil_kill(src);
+#pragma endscop
+}
+
+static void integral_64( const int rows
+                       , const int cols
+                       , const int src_step
+                       , const int sum_step
+                       , const int sqsum_step
+                       , const uint8_t src[static const restrict rows][src_step]
+                       , double sum[static const restrict rows + 1][sum_step]
+                       , double sqsum[static const restrict rows + 1][sqsum_step]
+                       )
+{
+#pragma scop
+    __pencil_assume(rows       >  0);
+    __pencil_assume(cols       >  0);
+    __pencil_assume(src_step   >= cols);
+    __pencil_assume(sum_step   >  cols);
+    __pencil_assume(sqsum_step >  cols);
+
+    __pencil_kill(sum);
+    __pencil_kill(sqsum);
+
+    #pragma pencil independent
+    for ( int c = 0; c <= cols; c++ )
+    {
+        sum[0][c] = 0;
+        sqsum[0][c] = 0;
+    }
+
+    #pragma pencil independent
+    for ( int r = 0; r < rows; r++ )
+    {
+        sum[r + 1][0] = 0;
+        sqsum[r + 1][0] = 0;
+        for ( int c = 0; c < cols; c++ )
+        {
+            const int pixel = src[r][c];
+            sum[r + 1][c + 1] = sum[r + 1][c] + pixel;
+            sqsum[r + 1][c + 1] = sqsum[r + 1][c] + pixel * pixel;
+        }
+    }
+
+    for ( int r = 1; r < rows; r++ )
+    {
+        #pragma pencil independent
+        for ( int c = 1; c <= cols; c++ )
+        {
+            sum[r + 1][c] += sum[r][c];
+            sqsum[r + 1][c] += sqsum[r][c];
+        }
+    }
+    __pencil_kill(src);
+#pragma endscop
+}
+
+void pencil_integral_32( const int rows
+                       , const int cols
+                       , const int src_step
+                       , const uint8_t src[]
+                       , const int sum_step
+                       , int32_t sum[]
+                       , const int sqsum_step
+                       , double sqsum[]
+                       )
+{
+    integral_32( rows, cols, src_step, sum_step, sqsum_step, (const uint8_t(*)[src_step])src, (int32_t(*)[sum_step])sum, (double(*)[sqsum_step])sqsum );
+}
+
+void pencil_integral_64( const int rows
+                       , const int cols
+                       , const int src_step
+                       , const uint8_t src[]
+                       , const int sum_step
+                       , double sum[]
+                       , const int sqsum_step
+                       , double sqsum[]
+                       )
+{
+    integral_64( rows, cols, src_step, sum_step, sqsum_step, (const uint8_t(*)[src_step])src, (double(*)[sum_step])sum, (double(*)[sqsum_step])sqsum );
+}
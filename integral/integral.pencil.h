@@ -0,0 +1,42 @@
+#ifndef INTEGRAL_PENCIL_H
+#define INTEGRAL_PENCIL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // Integral images of an 8-bit image, as cv::integral: sum and sqsum are (rows + 1) x (cols + 1),
+    // with a zero first row and column, and element [r][c] is the sum of the pixels (squared pixels)
+    // of src[0..r)[0..c). Steps are counted in elements.
+    // The 32-bit sums are exact while rows * cols * 255 fits in an int32_t (see INTEGRAL_SUM_FITS_32),
+    // otherwise pencil_integral_64 computes them as double (exact below 2^53, as the CV_64F sums of
+    // cv::integral). The squared sums are always double.
+    #define INTEGRAL_SUM_FITS_32(rows, cols) ( (double)(rows) * (double)(cols) * 255.0 <= (double)INT32_MAX )
+
+    void pencil_integral_32( const int rows
+                           , const int cols
+                           , const int src_step
+                           , const uint8_t src[]
+                           , const int sum_step
+                           , int32_t sum[]          //out
+                           , const int sqsum_step
+                           , double sqsum[]         //out
+                           );
+
+    void pencil_integral_64( const int rows
+                           , const int cols
+                           , const int src_step
+                           , const uint8_t src[]
+                           , const int sum_step
+                           , double sum[]           //out
+                           , const int sqsum_step
+                           , double sqsum[]         //out
+                           );
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* INTEGRAL_PENCIL_H */
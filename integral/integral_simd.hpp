@@ -0,0 +1,136 @@
+// SIMD CPU integral images of 8-bit images
+//
+// Same outputs as pencil_integral_32 / pencil_integral_64, in one pass over the image:
+// every row is loaded 8 pixels at a time and widened to int32, the prefix sum of the
+// 8 pixels (and of their squares) is computed in the register with two shifted adds
+// per 128-bit lane plus the carry of the low lane into the high one, the running total
+// of the row is added, and the output row above is added to the result before it is
+// stored, so the vertical accumulation is vectorized as well.
+// The squared sums, and the sums of pencil_integral_64, are converted to double only
+// after the in-register prefix sum, whose int32 totals cannot overflow.
+// Without AVX2 the rows are accumulated with a scalar loop.
+
+#ifndef INTEGRAL_SIMD_HPP
+#define INTEGRAL_SIMD_HPP
+
+#include "integral.pencil.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace carp {
+
+namespace integral {
+
+    enum {
+        PIXELS = 8,     // pixels per SIMD iteration
+    };
+
+#if defined(__AVX2__)
+    // inclusive prefix sum of the 8 int32 of x
+    inline __m256i prefix_sum( __m256i x ) {
+        x = _mm256_add_epi32( x, _mm256_slli_si256( x, 4 ) );
+        x = _mm256_add_epi32( x, _mm256_slli_si256( x, 8 ) );
+        // broadcast the total of every lane, then add the one of the low lane to the high lane
+        const __m256i totals = _mm256_shuffle_epi32( x, 0xFF );
+        return _mm256_add_epi32( x, _mm256_permute2x128_si256( totals, totals, 0x08 ) );
+    }
+
+    // Adds prefix sums of 8 pixels to the running total of the row and to the row above.
+    template <typename SumT>
+    struct accumulator;
+
+    template <>
+    struct accumulator<int32_t> {
+        __m256i run;
+
+        accumulator() : run( _mm256_setzero_si256() ) {}
+
+        void store( const __m256i prefix, const int32_t above[], int32_t out[] ) {
+            const __m256i row = _mm256_add_epi32( prefix, run );
+            run = _mm256_permutevar8x32_epi32( row, _mm256_set1_epi32( PIXELS - 1 ) );
+            const __m256i result = _mm256_add_epi32( row, _mm256_loadu_si256( reinterpret_cast<const __m256i*>(above) ) );
+            _mm256_storeu_si256( reinterpret_cast<__m256i*>(out), result );
+        }
+
+        int32_t total() const {
+            return _mm256_cvtsi256_si32( run );
+        }
+    };
+
+    template <>
+    struct accumulator<double> {
+        __m256d run;
+
+        accumulator() : run( _mm256_setzero_pd() ) {}
+
+        void store( const __m256i prefix, const double above[], double out[] ) {
+            const __m256d low  = _mm256_add_pd( _mm256_cvtepi32_pd( _mm256_castsi256_si128( prefix ) ), run );
+            const __m256d high = _mm256_add_pd( _mm256_cvtepi32_pd( _mm256_extracti128_si256( prefix, 1 ) ), run );
+            run = _mm256_permute4x64_pd( high, 0xFF );
+            _mm256_storeu_pd( out,     _mm256_add_pd( low,  _mm256_loadu_pd( above ) ) );
+            _mm256_storeu_pd( out + 4, _mm256_add_pd( high, _mm256_loadu_pd( above + 4 ) ) );
+        }
+
+        double total() const {
+            return _mm256_cvtsd_f64( run );
+        }
+    };
+#endif
+
+    // Computes the output row below sum_above / sqsum_above from the pixels of src.
+    template <typename SumT>
+    inline void row( const int cols, const uint8_t src[]
+                   , const SumT sum_above[], SumT sum[]
+                   , const double sqsum_above[], double sqsum[]
+                   )
+    {
+        sum[0] = 0;
+        sqsum[0] = 0;
+        SumT run = 0;
+        double sqrun = 0;
+        int c = 0;
+#if defined(__AVX2__)
+        accumulator<SumT> sum_acc;
+        accumulator<double> sqsum_acc;
+        for ( ; c + PIXELS <= cols; c += PIXELS ) {
+            const __m256i pixels = _mm256_cvtepu8_epi32( _mm_loadl_epi64( reinterpret_cast<const __m128i*>(src + c) ) );
+            sum_acc.store( prefix_sum( pixels ), sum_above + c + 1, sum + c + 1 );
+            sqsum_acc.store( prefix_sum( _mm256_mullo_epi32( pixels, pixels ) ), sqsum_above + c + 1, sqsum + c + 1 );
+        }
+        run = sum_acc.total();
+        sqrun = sqsum_acc.total();
+#endif
+        for ( ; c < cols; ++c ) {
+            const int pixel = src[c];
+            run += pixel;
+            sqrun += pixel * pixel;
+            sum[c + 1] = sum_above[c + 1] + run;
+            sqsum[c + 1] = sqsum_above[c + 1] + sqrun;
+        }
+    }
+}
+
+// Same interface and result as pencil_integral_32 (SumT = int32_t) and pencil_integral_64 (SumT = double).
+template <typename SumT>
+inline void integral_simd( const int rows, const int cols, const int src_step, const uint8_t src[]
+                         , const int sum_step, SumT sum[], const int sqsum_step, double sqsum[]
+                         )
+{
+    std::fill( sum, sum + cols + 1, SumT(0) );
+    std::fill( sqsum, sqsum + cols + 1, 0.0 );
+    for ( int r = 0; r < rows; ++r )
+        integral::row( cols, src + std::size_t(r) * src_step
+                     , sum + std::size_t(r) * sum_step, sum + std::size_t(r + 1) * sum_step
+                     , sqsum + std::size_t(r) * sqsum_step, sqsum + std::size_t(r + 1) * sqsum_step
+                     );
+}
+
+} // namespace carp
+
+#endif // INTEGRAL_SIMD_HPP
@@ -0,0 +1,153 @@
+#include "utility.hpp"
+#include "integral.pencil.h"
+#include "integral_simd.hpp"
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/ocl/ocl.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <prl.h>
+#include <chrono>
+
+void time_integral( const std::vector<carp::record_t>& pool, int iteration )
+{
+    bool first_execution_opencv = true, first_execution_pencil = true;
+
+    carp::Timing timing("integral image");
+
+    for ( int q=0; q<iteration; q++ ) {
+        for ( auto & item : pool ) {
+            // decoding straight to grayscale, the decoder skips the color conversion
+            const auto decode_start = std::chrono::high_resolution_clock::now();
+            cv::Mat cpu_gray = item.grayimg();
+            const auto decode_end = std::chrono::high_resolution_clock::now();
+            timing.print( "decode (gray)", decode_end - decode_start );
+
+            // 32-bit sums while they cannot overflow, as double otherwise
+            const bool fits_32 = INTEGRAL_SUM_FITS_32( cpu_gray.rows, cpu_gray.cols );
+            const int sum_type = fits_32 ? CV_32S : CV_64F;
+
+            cv::Mat cpu_sum, cpu_sqsum, gpu_sum, gpu_sqsum, pen_sum, pen_sqsum, simd_sum, simd_sqsum;
+            std::chrono::duration<double> elapsed_time_cpu, elapsed_time_gpu_p_copy;
+
+            {
+                const auto cpu_start = std::chrono::high_resolution_clock::now();
+                cv::integral( cpu_gray, cpu_sum, cpu_sqsum, sum_type );
+                const auto cpu_end = std::chrono::high_resolution_clock::now();
+                elapsed_time_cpu = cpu_end - cpu_start;
+            }
+            {
+                // Execute the kernel at least once before starting to take time measurements so that the OpenCV kernel gets compiled. The following run is not included in time measurements.
+                if (first_execution_opencv)
+                {
+                    cv::ocl::oclMat gpu_gray(cpu_gray);
+                    cv::ocl::oclMat sum, sqsum;
+                    cv::ocl::integral( gpu_gray, sum, sqsum );
+                    first_execution_opencv = false;
+                }
+
+                const auto gpu_start_copy = std::chrono::high_resolution_clock::now();
+                cv::ocl::oclMat gpu_gray(cpu_gray);
+                cv::ocl::oclMat sum, sqsum;
+                cv::ocl::integral( gpu_gray, sum, sqsum );
+                gpu_sum = sum;
+                gpu_sqsum = sqsum;
+                const auto gpu_end_copy = std::chrono::high_resolution_clock::now();
+                elapsed_time_gpu_p_copy = gpu_end_copy - gpu_start_copy;
+            }
+            {
+                pen_sum.create( cpu_sum.size(), sum_type );
+                pen_sqsum.create( cpu_sqsum.size(), CV_64F );
+
+                const auto run_pencil = [&]() {
+                    if (fits_32)
+                        pencil_integral_32( cpu_gray.rows, cpu_gray.cols, cpu_gray.step1(), cpu_gray.ptr<uint8_t>()
+                                          , pen_sum.step1(), pen_sum.ptr<int32_t>()
+                                          , pen_sqsum.step1(), pen_sqsum.ptr<double>()
+                                          );
+                    else
+                        pencil_integral_64( cpu_gray.rows, cpu_gray.cols, cpu_gray.step1(), cpu_gray.ptr<uint8_t>()
+                                          , pen_sum.step1(), pen_sum.ptr<double>()
+                                          , pen_sqsum.step1(), pen_sqsum.ptr<double>()
+                                          );
+                };
+
+                if (first_execution_pencil)
+                {
+                    run_pencil();
+                    first_execution_pencil = false;
+                }
+
+                prl_timings_reset();
+                prl_timings_start();
+                run_pencil();
+                prl_timings_stop();
+                // Dump execution times for PENCIL code.
+                prl_timings_dump();
+            }
+            {
+                simd_sum.create( cpu_sum.size(), sum_type );
+                simd_sqsum.create( cpu_sqsum.size(), CV_64F );
+
+                const auto simd_start = std::chrono::high_resolution_clock::now();
+                if (fits_32)
+                    carp::integral_simd( cpu_gray.rows, cpu_gray.cols, cpu_gray.step1(), cpu_gray.ptr<uint8_t>()
+                                       , simd_sum.step1(), simd_sum.ptr<int32_t>(), simd_sqsum.step1(), simd_sqsum.ptr<double>()
+                                       );
+                else
+                    carp::integral_simd( cpu_gray.rows, cpu_gray.cols, cpu_gray.step1(), cpu_gray.ptr<uint8_t>()
+                                       , simd_sum.step1(), simd_sum.ptr<double>(), simd_sqsum.step1(), simd_sqsum.ptr<double>()
+                                       );
+                const auto simd_end = std::chrono::high_resolution_clock::now();
+                timing.print( "SIMD integral", simd_end - simd_start );
+            }
+            // Verifying the results: the integer sums are exact in every implementation,
+            // OpenCL may accumulate the squared sums in single precision
+            cv::Mat gpu_sum_64, gpu_sqsum_64, cpu_sum_64;
+            gpu_sum.convertTo( gpu_sum_64, CV_64F );
+            gpu_sqsum.convertTo( gpu_sqsum_64, CV_64F );
+            cpu_sum.convertTo( cpu_sum_64, CV_64F );
+            const double gpu_sqsum_err = cv::norm( gpu_sqsum_64, cpu_sqsum, cv::NORM_INF ) / std::max( 1.0, cv::norm( cpu_sqsum, cv::NORM_INF ) );
+            if ( (cv::norm( gpu_sum_64, cpu_sum_64, cv::NORM_INF ) > 0.01) || (gpu_sqsum_err > 1e-5)
+              || (cv::norm( pen_sum, cpu_sum, cv::NORM_INF ) != 0) || (cv::norm( pen_sqsum, cpu_sqsum, cv::NORM_INF ) != 0)
+               ) {
+                std::cerr << "ERROR: Results don't match." << std::endl;
+                std::cerr << "GPU-CPU sum norm:" << cv::norm( gpu_sum_64, cpu_sum_64, cv::NORM_INF ) << std::endl;
+                std::cerr << "GPU-CPU sqsum relative error:" << gpu_sqsum_err << std::endl;
+                std::cerr << "PEN-CPU sum norm:" << cv::norm( pen_sum, cpu_sum, cv::NORM_INF ) << std::endl;
+                std::cerr << "PEN-CPU sqsum norm:" << cv::norm( pen_sqsum, cpu_sqsum, cv::NORM_INF ) << std::endl;
+                throw std::runtime_error("The OpenCL or PENCIL results are not equivalent with the C++ results.");
+            }
+            if ( (cv::norm( simd_sum, cpu_sum, cv::NORM_INF ) != 0) || (cv::norm( simd_sqsum, cpu_sqsum, cv::NORM_INF ) != 0) )
+                throw std::runtime_error("The SIMD integral is not equivalent with the C++ results.");
+
+            // Dump execution times for OpenCV calls.
+            timing.print( elapsed_time_cpu, elapsed_time_gpu_p_copy );
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    prl_init((prl_init_flags)(PRL_TARGET_DEVICE_DYNAMIC | PRL_PROFILING_ENABLED));
+
+    try {
+        std::cout << "This executable is iterating over all the files passed to it as an argument. " << std::endl;
+
+        auto pool = carp::get_pool(argc, argv);
+
+#ifdef RUN_ONLY_ONE_EXPERIMENT
+        time_integral( pool, 1 );
+#else
+        time_integral( pool, 25 );
+#endif
+
+        prl_shutdown();
+        return EXIT_SUCCESS;
+    }catch(const std::exception& e) {
+        std::cout << e.what() << std::endl;
+
+        prl_shutdown();
+        return EXIT_FAILURE;
+    }
+}
@@ -1,5 +1,6 @@
 #include "utility.hpp"
 #include "resize.pencil.h"
+#include "remap.hpp"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/ocl/ocl.hpp>
@@ -8,20 +9,34 @@
 #include <prl.h>
 #include <chrono>
 
+// The images are decoded at 1/DECODE_SCALE_DENOM (1, 2, 4 or 8) of their size; as the kernel
+// downsizes anyway, a larger denominator lets libjpeg skip most of the decoding work.
+#ifndef DECODE_SCALE_DENOM
+#define DECODE_SCALE_DENOM 1
+#endif
+
 void time_resize( const std::vector<carp::record_t>& pool, const std::vector<cv::Size>& sizes, int iteration )
 {
     bool first_execution_opencv = true, first_execution_pencil = true;
 
     carp::Timing timing("resize");
 
-    for ( int q=0; q<iteration; q++ ) {
-        for ( auto & size : sizes ) {
-            for ( auto & item : pool ) {
-                cv::Mat cpu_gray;
-                cv::cvtColor( item.cpuimg(), cpu_gray, CV_RGB2GRAY );
+    // remap tables depend only on the source and destination sizes, they are prepared on first use
+    std::vector<carp::remap_maps> maps( sizes.size() * pool.size() );
 
-                cv::Mat cpu_result, gpu_result, pen_result;
-                std::chrono::duration<double> elapsed_time_cpu, elapsed_time_gpu_p_copy;
+    for ( int q=0; q<iteration; q++ ) {
+        for ( size_t size_idx = 0; size_idx < sizes.size(); ++size_idx ) {
+            const cv::Size & size = sizes[size_idx];
+            for ( size_t item_idx = 0; item_idx < pool.size(); ++item_idx ) {
+                auto & item = pool[item_idx];
+                // decoding straight to grayscale, the decoder skips the color conversion
+                const auto decode_start = std::chrono::high_resolution_clock::now();
+                cv::Mat cpu_gray = item.grayimg(DECODE_SCALE_DENOM);
+                const auto decode_end = std::chrono::high_resolution_clock::now();
+                timing.print( "decode (gray)", decode_end - decode_start );
+
+                cv::Mat cpu_result, gpu_result, pen_result, map_result;
+                std::chrono::duration<double> elapsed_time_cpu, elapsed_time_gpu_p_copy, elapsed_time_remap;
 
                 {
                     const auto cpu_start = std::chrono::high_resolution_clock::now();
@@ -64,6 +79,23 @@ void time_resize( const std::vector<carp::record_t>& pool, const std::vector<cv:
                     // Dump execution times for PENCIL code.
                     prl_timings_dump();
                 }
+                {
+                    // shared remap machinery: resize expressed as precomputed maps
+                    carp::remap_maps & size_maps = maps[size_idx * pool.size() + item_idx];
+                    if (size_maps.empty())
+                    {
+                        const auto prepare_start = std::chrono::high_resolution_clock::now();
+                        size_maps = carp::remap_maps::resize( cpu_gray.rows, cpu_gray.cols, size.height, size.width );
+                        const auto prepare_end = std::chrono::high_resolution_clock::now();
+                        timing.print( "remap tables prepare (CPU)", prepare_end - prepare_start );
+                    }
+                    map_result.create(size, CV_8UC1);
+
+                    const auto remap_start = std::chrono::high_resolution_clock::now();
+                    carp::remap_linear( size_maps, cpu_gray.step1(), cpu_gray.ptr<uint8_t>(), map_result.step1(), map_result.ptr<uint8_t>() );
+                    const auto remap_end = std::chrono::high_resolution_clock::now();
+                    elapsed_time_remap = remap_end - remap_start;
+                }
                 // Verifying the results - TODO - Something fishy is happening at borders
 #define REMOVE_BORDER(img) img(cv::Range(1, size.height-1), cv::Range(1, size.width-1))
                 if (( cv::norm(REMOVE_BORDER(cpu_result), REMOVE_BORDER(gpu_result), cv::NORM_INF) > 1 )
@@ -78,8 +110,17 @@ void time_resize( const std::vector<carp::record_t>& pool, const std::vector<cv:
 
                     throw std::runtime_error("The GPU results are not equivalent with the CPU or Pencil results.");
                 }
+                // The maps quantize the bilinear fractions to 1/INTER_TAB_SIZE, so edges can be off by up to 255/INTER_TAB_SIZE
+                if ( cv::norm(REMOVE_BORDER(cpu_result), REMOVE_BORDER(map_result), cv::NORM_INF) > 255. / carp::remap::INTER_TAB_SIZE + 1 )
+                {
+                    cv::imwrite( "cpu_resize.png", cpu_result );
+                    cv::imwrite( "remap_resize.png", map_result );
+
+                    throw std::runtime_error("The remap results are not equivalent with the CPU results.");
+                }
                 // Dump execution times for OpenCV calls.
                 timing.print( elapsed_time_cpu, elapsed_time_gpu_p_copy );
+                timing.print( "remap tables apply (CPU)", elapsed_time_remap );
             } // for pool
         }
     }
@@ -101,6 +101,16 @@ get_median()
 	sort -n $FILE | nawk 'NF{a[NR]=$1;c++}END {printf (c%2==0)?(a[int(c/2)+1]+a[int(c/2)])/2:a[int(c/2)+1]}'
 }
 
+# Test drivers that also call the PENCIL kernels of another benchmark
+# (their libraries are built first as they come earlier in LIST_OF_KERNELS).
+# USAGE: "extra_kernels $KERNEL"
+extra_kernels()
+{
+  case $1 in
+    filter2D|gaussian|warpAffine) echo "cvt_color";;
+  esac
+}
+
 # Compile the kernel ($1) with ppcg and then with g++
 compile()
 {
@@ -122,7 +132,14 @@ compile()
   g++ -shared -O3 -o lib${KERNEL}_ppcg.so $KERNEL.pencil_host.o $LINKER_FLAGS $LIBRARY_FLAGS &>> $LOG_FILE
   EXIT_STATUS_COMPILATION_2=$?
 
-  g++ -O3 $DEFINED_VARIABLES -fomit-frame-pointer -fPIC -std=c++0x $HEADER_FLAGS -Wl,-rpath=RIGIN:$PRL_LIB_DIR $BENCHMARK_ROOT_DIRECTORY/$KERNEL/test_${KERNEL}.cpp -o ppcg_test_${KERNEL} $LIBRARY_FLAGS $LINKER_FLAGS -l${KERNEL}_ppcg &>> $LOG_FILE
+  EXTRA_HEADER_FLAGS=""
+  EXTRA_LIBRARY_FLAGS=""
+  for extra in `extra_kernels $KERNEL`; do
+    EXTRA_HEADER_FLAGS="$EXTRA_HEADER_FLAGS -I$BENCHMARK_ROOT_DIRECTORY/$extra"
+    EXTRA_LIBRARY_FLAGS="$EXTRA_LIBRARY_FLAGS -l${extra}_ppcg"
+  done
+
+  g++ -O3 $DEFINED_VARIABLES -fomit-frame-pointer -fPIC -std=c++0x $HEADER_FLAGS $EXTRA_HEADER_FLAGS -Wl,-rpath=RIGIN:$PRL_LIB_DIR $BENCHMARK_ROOT_DIRECTORY/$KERNEL/test_${KERNEL}.cpp -o ppcg_test_${KERNEL} $LIBRARY_FLAGS $LINKER_FLAGS -l${KERNEL}_ppcg $EXTRA_LIBRARY_FLAGS &>> $LOG_FILE
   EXIT_STATUS_COMPILATION_3=$?
 
   EXIT_STATUS_COMPILATION=`expr $EXIT_STATUS_COMPILATION_1 + $EXIT_STATUS_COMPILATION_2 + $EXIT_STATUS_COMPILATION_3`
@@ -1,5 +1,9 @@
 #include "utility.hpp"
 #include "warpAffine.pencil.h"
+#include "cvt_color.pencil.h"
+#include "warpAffine_fixed.hpp"
+#include "warpAffine_batch.hpp"
+#include "remap.hpp"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/ocl/ocl.hpp>
@@ -7,6 +11,8 @@
 
 #include <prl.h>
 #include <chrono>
+#include <random>
+#include <cmath>
 
 namespace
 {
@@ -25,6 +31,30 @@ namespace
         M[2] = b1;
         M[5] = b2;
     }
+
+    // Random augmentation transforms around the image center, already inverted the way pencil_affine_linear expects them.
+    std::vector<carp::affine_coeffs> random_transforms( int rows, int cols, int count, std::mt19937 & rng )
+    {
+        std::uniform_real_distribution<float> angle_dist( -0.17f, 0.17f );
+        std::uniform_real_distribution<float> scale_dist( 0.9f, 1.1f );
+        std::uniform_real_distribution<float> shift_dist( -0.05f, 0.05f );
+
+        std::vector<carp::affine_coeffs> result;
+        for ( int i = 0; i < count; ++i ) {
+            const float angle = angle_dist(rng);
+            const float scale = scale_dist(rng);
+            const float alpha = scale * std::cos(angle);
+            const float beta  = scale * std::sin(angle);
+            const float cx = 0.5f * cols, cy = 0.5f * rows;
+            float M[6] = { alpha, beta, (1 - alpha) * cx - beta * cy + shift_dist(rng) * cols
+                         , -beta, alpha, beta * cx + (1 - alpha) * cy + shift_dist(rng) * rows
+                         };
+            convert_coeffs(M);
+            const carp::affine_coeffs coeffs = { M[0], M[1], M[3], M[4], M[5], M[2] };
+            result.push_back(coeffs);
+        }
+        return result;
+    }
 }
 
 void time_affine( const std::vector<carp::record_t>& pool, int iteration )
@@ -33,19 +63,24 @@ void time_affine( const std::vector<carp::record_t>& pool, int iteration )
 
     carp::Timing timing("affine transform");
 
+    // The transform is the same for every iteration, so its remap tables are prepared once per image.
+    std::vector<carp::remap_maps> maps( pool.size() );
+
     for ( int q=0; q<iteration; q++ ) {
-        for ( auto & item : pool ) {
-            cv::Mat cpu_gray;
-            cv::cvtColor( item.cpuimg(), cpu_gray, CV_RGB2GRAY );
-            cpu_gray.convertTo( cpu_gray, CV_32F, 1.0/255. );
+        for ( size_t item_idx = 0; item_idx < pool.size(); ++item_idx ) {
+            auto & item = pool[item_idx];
+            // gray conversion and normalization to [0,1] in one pass
+            const cv::Mat rgb = item.cpuimg();
+            cv::Mat cpu_gray( rgb.size(), CV_32F );
+            pencil_RGB2Gray_f32( rgb.rows, rgb.cols, rgb.step1()/rgb.channels(), cpu_gray.step1(), rgb.data, cpu_gray.ptr<float>() );
 
             std::vector<float> transform_data = { 2.0f, 0.5f, -500.0f
                                                 , 0.333f, 3.0f, -500.0f
                                                 };
             cv::Mat transform( 2, 3, CV_32F, transform_data.data() );
 
-            cv::Mat cpu_result, gpu_result, pen_result;
-            std::chrono::duration<double> elapsed_time_cpu, elapsed_time_gpu_p_copy;
+            cv::Mat cpu_result, gpu_result, pen_result, fix_result, map_result;
+            std::chrono::duration<double> elapsed_time_cpu, elapsed_time_gpu_p_copy, elapsed_time_fixed, elapsed_time_remap;
 
             {
                 const auto cpu_start = std::chrono::high_resolution_clock::now();
@@ -92,6 +127,36 @@ void time_affine( const std::vector<carp::record_t>& pool, int iteration )
                 // Dump execution times for PENCIL code.
                 prl_timings_dump();
             }
+            {
+                // fixed-point CPU variant, uses the same (already inverted) coefficients as the PENCIL code
+                fix_result.create( cpu_gray.size(), CV_32F );
+
+                const auto fix_start = std::chrono::high_resolution_clock::now();
+                carp::affine_linear_fixed( cpu_gray.rows, cpu_gray.cols, cpu_gray.step1(), cpu_gray.ptr<float>()
+                                         , fix_result.rows, fix_result.cols, fix_result.step1(), fix_result.ptr<float>(),
+                        transform.at<float>(0,0), transform.at<float>(0,1), transform.at<float>(1,0), transform.at<float>(1,1),
+                        transform.at<float>(1,2), transform.at<float>(0,2) );
+                const auto fix_end = std::chrono::high_resolution_clock::now();
+                elapsed_time_fixed = fix_end - fix_start;
+            }
+            {
+                // prepare once, apply many: only the first iteration builds the tables
+                if (maps[item_idx].empty())
+                {
+                    const auto prepare_start = std::chrono::high_resolution_clock::now();
+                    maps[item_idx] = carp::remap_maps::affine( cpu_gray.rows, cpu_gray.cols, cpu_gray.rows, cpu_gray.cols,
+                            transform.at<float>(0,0), transform.at<float>(0,1), transform.at<float>(1,0), transform.at<float>(1,1),
+                            transform.at<float>(1,2), transform.at<float>(0,2) );
+                    const auto prepare_end = std::chrono::high_resolution_clock::now();
+                    timing.print( "remap tables prepare (CPU)", prepare_end - prepare_start );
+                }
+                map_result.create( cpu_gray.size(), CV_32F );
+
+                const auto remap_start = std::chrono::high_resolution_clock::now();
+                carp::remap_linear( maps[item_idx], cpu_gray.step1(), cpu_gray.ptr<float>(), map_result.step1(), map_result.ptr<float>() );
+                const auto remap_end = std::chrono::high_resolution_clock::now();
+                elapsed_time_remap = remap_end - remap_start;
+            }
             // Verifying the results
             if ( (cv::norm(cv::abs(cpu_result - gpu_result), cv::NORM_INF ) > 1 ) || (cv::norm(cv::abs(cpu_result - pen_result), cv::NORM_INF ) > 1 ) )
             {
@@ -109,8 +174,113 @@ void time_affine( const std::vector<carp::record_t>& pool, int iteration )
 
                 throw std::runtime_error("The GPU results are not equivalent with the CPU results.");
             }
+            // The quantized weights are off by at most half a table step per axis, and the input is in [0,1]
+            const double fixed_tolerance = 1.0 / carp::affine_fixed::INTER_TAB_SIZE + 1e-3;
+            const double remap_tolerance = 1.0 / carp::remap::INTER_TAB_SIZE + 1e-3;
+            if ( ( cv::norm(cv::abs(pen_result - fix_result), cv::NORM_INF ) > fixed_tolerance )
+              || ( cv::norm(cv::abs(pen_result - map_result), cv::NORM_INF ) > remap_tolerance ) )
+            {
+                cv::Mat pen_result8;
+                cv::Mat fix_result8;
+                cv::Mat map_result8;
+
+                pen_result.convertTo( pen_result8, CV_8UC1, 255. );
+                fix_result.convertTo( fix_result8, CV_8UC1, 255. );
+                map_result.convertTo( map_result8, CV_8UC1, 255. );
+
+                cv::imwrite( "pencil_affine.png", pen_result8 );
+                cv::imwrite( "fixed_affine.png", fix_result8 );
+                cv::imwrite( "remap_affine.png", map_result8 );
+
+                throw std::runtime_error("The fixed-point results are not equivalent with the PENCIL results.");
+            }
             // Dump execution times for OpenCV calls.
             timing.print( elapsed_time_cpu, elapsed_time_gpu_p_copy );
+            timing.print( "fixed-point affine (CPU)", elapsed_time_fixed );
+            timing.print( "remap tables apply (CPU)", elapsed_time_remap );
+        }
+    }
+}
+
+void time_affine_batch( const std::vector<carp::record_t>& pool, int iteration, int num_transforms )
+{
+    carp::Timing timing("affine transform batch");
+    std::mt19937 rng(2015);
+
+    for ( int q=0; q<iteration; q++ ) {
+        for ( auto & item : pool ) {
+            // gray conversion and normalization to [0,1] in one pass
+            const cv::Mat rgb = item.cpuimg();
+            cv::Mat cpu_gray( rgb.size(), CV_32F );
+            pencil_RGB2Gray_f32( rgb.rows, rgb.cols, rgb.step1()/rgb.channels(), cpu_gray.step1(), rgb.data, cpu_gray.ptr<float>() );
+
+            const std::vector<carp::affine_coeffs> transforms = random_transforms( cpu_gray.rows, cpu_gray.cols, num_transforms, rng );
+            std::vector<cv::Mat> pen_results(num_transforms), seq_results(num_transforms), batch_results(num_transforms);
+            std::vector<float*> batch_ptrs(num_transforms);
+            for ( int i = 0; i < num_transforms; ++i ) {
+                pen_results[i].create( cpu_gray.size(), CV_32F );
+                seq_results[i].create( cpu_gray.size(), CV_32F );
+                batch_results[i].create( cpu_gray.size(), CV_32F );
+                batch_ptrs[i] = batch_results[i].ptr<float>();
+            }
+            std::chrono::duration<double> elapsed_time_pencil, elapsed_time_sequential, elapsed_time_batch;
+
+            {
+                // one pencil_affine_linear call per transform, as the augmentation jobs do it today
+                const auto pen_start = std::chrono::high_resolution_clock::now();
+                for ( int i = 0; i < num_transforms; ++i ) {
+                    const carp::affine_coeffs & t = transforms[i];
+                    pencil_affine_linear( cpu_gray.rows, cpu_gray.cols, cpu_gray.step1(), cpu_gray.ptr<float>()
+                                        , pen_results[i].rows, pen_results[i].cols, pen_results[i].step1(), pen_results[i].ptr<float>()
+                                        , t.a00, t.a01, t.a10, t.a11, t.b00, t.b10 );
+                }
+                const auto pen_end = std::chrono::high_resolution_clock::now();
+                elapsed_time_pencil = pen_end - pen_start;
+            }
+            {
+                const auto seq_start = std::chrono::high_resolution_clock::now();
+                for ( int i = 0; i < num_transforms; ++i ) {
+                    const carp::affine_coeffs & t = transforms[i];
+                    carp::affine_linear_fixed( cpu_gray.rows, cpu_gray.cols, cpu_gray.step1(), cpu_gray.ptr<float>()
+                                             , seq_results[i].rows, seq_results[i].cols, seq_results[i].step1(), seq_results[i].ptr<float>()
+                                             , t.a00, t.a01, t.a10, t.a11, t.b00, t.b10 );
+                }
+                const auto seq_end = std::chrono::high_resolution_clock::now();
+                elapsed_time_sequential = seq_end - seq_start;
+            }
+            {
+                const auto batch_start = std::chrono::high_resolution_clock::now();
+                carp::affine_linear_fixed_batch( cpu_gray.rows, cpu_gray.cols, cpu_gray.step1(), cpu_gray.ptr<float>()
+                                               , cpu_gray.rows, cpu_gray.cols, batch_results[0].step1()
+                                               , num_transforms, transforms.data(), batch_ptrs.data() );
+                const auto batch_end = std::chrono::high_resolution_clock::now();
+                elapsed_time_batch = batch_end - batch_start;
+            }
+            // Verifying the results: the batch computes exactly the same pixels as the sequential calls
+            const double fixed_tolerance = 1.0 / carp::affine_fixed::INTER_TAB_SIZE + 1e-3;
+            for ( int i = 0; i < num_transforms; ++i ) {
+                if ( ( cv::norm(cv::abs(seq_results[i] - batch_results[i]), cv::NORM_INF ) > 1e-6 )
+                  || ( cv::norm(cv::abs(pen_results[i] - batch_results[i]), cv::NORM_INF ) > fixed_tolerance ) )
+                {
+                    cv::Mat pen_result8;
+                    cv::Mat batch_result8;
+
+                    pen_results[i].convertTo( pen_result8, CV_8UC1, 255. );
+                    batch_results[i].convertTo( batch_result8, CV_8UC1, 255. );
+
+                    cv::imwrite( "pencil_affine.png", pen_result8 );
+                    cv::imwrite( "batch_affine.png", batch_result8 );
+
+                    throw std::runtime_error("The batched results are not equivalent with the sequential results.");
+                }
+            }
+            timing.print( "sequential pencil_affine_linear", elapsed_time_pencil );
+            timing.print( "sequential fixed-point affine (CPU)", elapsed_time_sequential );
+            timing.print( "batched fixed-point affine (CPU)", elapsed_time_batch );
+            std::cout << "Outputs per second: "
+                      << num_transforms / elapsed_time_pencil.count() << " - sequential pencil, "
+                      << num_transforms / elapsed_time_sequential.count() << " - sequential fixed-point, "
+                      << num_transforms / elapsed_time_batch.count() << " - batched fixed-point" << std::endl;
         }
     }
 }
@@ -127,6 +297,8 @@ int main(int argc, char* argv[])
     time_affine( pool,  1 );
 #else
     time_affine( pool, 20 );
+    time_affine_batch( pool,  5, 16 );
+    time_affine_batch( pool,  5, 64 );
 #endif
 
     prl_shutdown();
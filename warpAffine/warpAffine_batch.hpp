@@ -0,0 +1,205 @@
+// Batched fixed-point affine warps of one source image
+//
+// Applying many transforms to the same source one after the other streams the whole
+// source through the cache once per transform. Here the source is split into tiles and
+// the work is scheduled source tile by source tile: for every transform, only the
+// destination pixels whose source position falls into the current tile are computed.
+// The tile is therefore loaded once and reused by all transforms while it is in cache.
+// Work is parallelized over source tiles and groups of transforms; every destination
+// pixel is owned by exactly one source tile, so the tasks write disjoint pixels.
+
+#ifndef WARPAFFINE_BATCH_HPP
+#define WARPAFFINE_BATCH_HPP
+
+#include "warpAffine_fixed.hpp"
+
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#ifdef WITH_TBB
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range2d.h>
+#endif
+
+namespace carp {
+
+// Coefficients in the order and convention of pencil_affine_linear.
+struct affine_coeffs {
+    float a00, a01, a10, a11, b00, b10;
+};
+
+namespace affine_batch {
+
+    enum {
+        SRC_TILE_ROWS   = 128,
+        SRC_TILE_COLS   = 128,
+        TRANSFORM_GRAIN = 8,
+    };
+
+    // First n in [lo, hi) for which pred(n) holds, pred being monotone (false...true).
+    // The estimate is usually exact, the correction steps only fix the rounding.
+    template <typename Pred>
+    inline int first_true( const int lo, const int hi, double estimate, Pred pred ) {
+        if (!(estimate > lo)) estimate = lo;
+        if (!(estimate < hi)) estimate = hi;
+        int n = static_cast<int>(estimate);
+        while ( n > lo && pred(n - 1) )
+            --n;
+        while ( n < hi && !pred(n) )
+            ++n;
+        return n;
+    }
+
+    // Narrows [begin, end) to the n for which lo_th <= base + slope * n < hi_th.
+    // Infinite thresholds leave that side open.
+    inline void clip_span( const double base, const double slope, const double lo_th, const double hi_th, int & begin, int & end ) {
+        if ( begin >= end )
+            return;
+        const int lo = begin, hi = end;
+        if ( slope > 0 ) {
+            if ( lo_th > -std::numeric_limits<double>::infinity() )
+                begin = first_true( lo, hi, std::ceil((lo_th - base) / slope), [=](int n) { return base + slope * n >= lo_th; } );
+            if ( hi_th <  std::numeric_limits<double>::infinity() )
+                end   = first_true( lo, hi, std::ceil((hi_th - base) / slope), [=](int n) { return base + slope * n >= hi_th; } );
+        } else if ( slope < 0 ) {
+            if ( hi_th <  std::numeric_limits<double>::infinity() )
+                begin = first_true( lo, hi, std::floor((hi_th - base) / slope), [=](int n) { return base + slope * n < hi_th; } );
+            if ( lo_th > -std::numeric_limits<double>::infinity() )
+                end   = first_true( lo, hi, std::floor((lo_th - base) / slope), [=](int n) { return base + slope * n < lo_th; } );
+        } else if ( !(base >= lo_th && base < hi_th) ) {
+            end = begin;
+        }
+        end = std::max(begin, end);
+    }
+
+    // Destination rows that may contain pixels sampled from the source rectangle [c0,c1)x[r0,r1).
+    inline void row_range( const affine_coeffs & t, const int dst_rows
+                         , const double c0, const double c1, const double r0, const double r1
+                         , int & row_begin, int & row_end
+                         )
+    {
+        const double det = double(t.a00) * t.a11 - double(t.a01) * t.a10;
+        if ( std::fabs(det) < 1e-12 ) {
+            row_begin = 0;
+            row_end = dst_rows;
+            return;
+        }
+        double lo = std::numeric_limits<double>::infinity();
+        double hi = -lo;
+        const double cs[2] = { c0, c1 };
+        const double rs[2] = { r0, r1 };
+        for ( int i = 0; i < 2; ++i )
+            for ( int j = 0; j < 2; ++j ) {
+                // invert o_c = a00 * n_c + a01 * n_r + b10, o_r = a10 * n_c + a11 * n_r + b00
+                const double n_r = ( double(t.a00) * (rs[j] - t.b00) - double(t.a10) * (cs[i] - t.b10) ) / det;
+                lo = std::min(lo, n_r);
+                hi = std::max(hi, n_r);
+            }
+        lo = std::min(std::max(lo, -1.0), double(dst_rows));
+        hi = std::min(std::max(hi, -1.0), double(dst_rows));
+        row_begin = std::max( static_cast<int>(std::floor(lo)) - 2, 0 );
+        row_end   = std::min( static_cast<int>(std::ceil (hi)) + 2, dst_rows );
+    }
+
+    struct job {
+        affine_coeffs coeffs;
+        affine_fixed::transform fixed;
+        float * dst;
+        double bbox_c0, bbox_c1, bbox_r0, bbox_r1;   // source positions covered by the whole destination
+
+        job( const affine_coeffs & c, const int dst_rows, const int dst_cols, float * dst_ )
+            : coeffs(c), fixed(dst_cols, c.a00, c.a01, c.a10, c.a11, c.b00, c.b10), dst(dst_)
+        {
+            bbox_c0 = bbox_r0 = std::numeric_limits<double>::infinity();
+            bbox_c1 = bbox_r1 = -bbox_c0;
+            const double ns_r[2] = { 0.0, double(dst_rows) };
+            const double ns_c[2] = { 0.0, double(dst_cols) };
+            for ( int i = 0; i < 2; ++i )
+                for ( int j = 0; j < 2; ++j ) {
+                    const double o_c = double(c.a01) * ns_r[i] + double(c.a00) * ns_c[j] + c.b10;
+                    const double o_r = double(c.a11) * ns_r[i] + double(c.a10) * ns_c[j] + c.b00;
+                    bbox_c0 = std::min(bbox_c0, o_c - 1);
+                    bbox_c1 = std::max(bbox_c1, o_c + 1);
+                    bbox_r0 = std::min(bbox_r0, o_r - 1);
+                    bbox_r1 = std::max(bbox_r1, o_r + 1);
+                }
+        }
+    };
+
+    // Computes every destination pixel of job j whose (clamped) source position lies in source tile (tr, tc).
+    inline void tile( const int src_rows, const int src_cols, const int src_step, const float src[]
+                    , const int dst_rows, const int dst_cols, const int dst_step
+                    , const int tr, const int tc, const job & j
+                    )
+    {
+        const double inf = std::numeric_limits<double>::infinity();
+        const int last_tr = (src_rows - 1) / SRC_TILE_ROWS;
+        const int last_tc = (src_cols - 1) / SRC_TILE_COLS;
+
+        // ownership thresholds; border tiles also own everything beyond the image
+        const double lo_c = tc == 0       ? -inf : double(tc * SRC_TILE_COLS);
+        const double hi_c = tc == last_tc ?  inf : double((tc + 1) * SRC_TILE_COLS);
+        const double lo_r = tr == 0       ? -inf : double(tr * SRC_TILE_ROWS);
+        const double hi_r = tr == last_tr ?  inf : double((tr + 1) * SRC_TILE_ROWS);
+
+        if ( lo_c >= j.bbox_c1 || hi_c <= j.bbox_c0 || lo_r >= j.bbox_r1 || hi_r <= j.bbox_r0 )
+            return;
+
+        int row_begin, row_end;
+        row_range( j.coeffs, dst_rows
+                 , std::max(lo_c, j.bbox_c0), std::min(hi_c, j.bbox_c1)
+                 , std::max(lo_r, j.bbox_r0), std::min(hi_r, j.bbox_r1)
+                 , row_begin, row_end
+                 );
+
+        const affine_coeffs & t = j.coeffs;
+        for ( int n_r = row_begin; n_r < row_end; ++n_r ) {
+            int c_begin = 0, c_end = dst_cols;
+            clip_span( double(t.a01) * n_r + t.b10, t.a00, lo_c, hi_c, c_begin, c_end );
+            clip_span( double(t.a11) * n_r + t.b00, t.a10, lo_r, hi_r, c_begin, c_end );
+            if ( c_begin < c_end )
+                affine_fixed::row( src_rows, src_cols, src_step, src, j.dst + size_t(n_r) * dst_step, n_r, c_begin, c_end, j.fixed, j.fixed.row_fits(n_r) );
+        }
+    }
+}
+
+// Applies num_transforms affine transforms to the same source image; transform i writes dst[i].
+// All outputs share the destination size and step. The result equals num_transforms calls of
+// affine_linear_fixed.
+inline void affine_linear_fixed_batch( const int src_rows, const int src_cols, const int src_step, const float src[]
+                                     , const int dst_rows, const int dst_cols, const int dst_step
+                                     , const int num_transforms, const affine_coeffs transforms[], float * const dst[]
+                                     )
+{
+    std::vector<affine_batch::job> jobs;
+    jobs.reserve(num_transforms);
+    for ( int i = 0; i < num_transforms; ++i )
+        jobs.push_back( affine_batch::job( transforms[i], dst_rows, dst_cols, dst[i] ) );
+
+    const int tiles_r = (src_rows + affine_batch::SRC_TILE_ROWS - 1) / affine_batch::SRC_TILE_ROWS;
+    const int tiles_c = (src_cols + affine_batch::SRC_TILE_COLS - 1) / affine_batch::SRC_TILE_COLS;
+    const int num_tiles = tiles_r * tiles_c;
+
+#ifdef WITH_TBB
+    tbb::parallel_for( tbb::blocked_range2d<int>(0, num_tiles, 1, 0, num_transforms, affine_batch::TRANSFORM_GRAIN), [&](const tbb::blocked_range2d<int> & range) {
+    for ( int tile = range.rows().begin(); tile != range.rows().end(); ++tile ) {
+        for ( int i = range.cols().begin(); i != range.cols().end(); ++i ) {
+#else
+    for ( int tile = 0; tile < num_tiles; ++tile ) {
+        for ( int i = 0; i < num_transforms; ++i ) {
+#endif
+            affine_batch::tile( src_rows, src_cols, src_step, src, dst_rows, dst_cols, dst_step
+                              , tile / tiles_c, tile % tiles_c, jobs[i]
+                              );
+        }
+    }
+#ifdef WITH_TBB
+    });
+#endif
+}
+
+} // namespace carp
+
+#endif // WARPAFFINE_BATCH_HPP
@@ -0,0 +1,274 @@
+// Fixed-point CPU variant of pencil_affine_linear
+//
+// Source coordinates are kept in 16.16 fixed point, so splitting them into the
+// integer pixel position and the fractional part is a shift and a mask. The
+// fractional part is quantized to INTER_BITS and looked up in a table of
+// bilinear weights (the same scheme as OpenCV's INTER_BITS/INTER_TAB_SIZE).
+// carp::remap_maps (remap.hpp) precomputes the same kind of coordinates once when
+// a transform is applied repeatedly.
+// With AVX2 the four neighbours of 8 destination pixels are fetched with gathers;
+// NEON has no gather, so the addresses are computed in vector registers and the
+// neighbours are loaded lane by lane.
+
+#ifndef WARPAFFINE_FIXED_HPP
+#define WARPAFFINE_FIXED_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "remap.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace carp {
+
+namespace affine_fixed {
+
+    enum {
+        COORD_BITS     = 16,
+        INTER_BITS     = 5,
+        INTER_TAB_SIZE = 1 << INTER_BITS,
+        FRAC_SHIFT     = COORD_BITS - INTER_BITS,
+        ROUND_DELTA    = 1 << (FRAC_SHIFT - 1),
+    };
+
+    typedef bilinear_tab<INTER_BITS> tab_t;
+
+    inline int32_t to_fixed( double v ) {
+        return static_cast<int32_t>( std::llround( v * (1 << COORD_BITS) ) );
+    }
+
+    inline bool fits_fixed( double v ) {
+        // keep a margin for the rounding delta and the per-column offsets
+        const double limit = double(std::numeric_limits<int32_t>::max() - (1 << COORD_BITS)) / (1 << COORD_BITS);
+        return std::fabs(v) < limit;
+    }
+
+    // Per-transform state: the column dependent part of the coordinates is tabulated once,
+    // the row dependent part is added per row. Coordinates follow pencil_affine_linear:
+    //   o_r = a11 * n_r + a10 * n_c + b00
+    //   o_c = a01 * n_r + a00 * n_c + b10
+    struct transform {
+        float a00, a01, a10, a11, b00, b10;
+        std::vector<int32_t> col_ofs_c;
+        std::vector<int32_t> col_ofs_r;
+        bool fixed_ok;
+
+        transform( const int dst_cols
+                 , const float a00_, const float a01_, const float a10_, const float a11_, const float b00_, const float b10_
+                 )
+            : a00(a00_), a01(a01_), a10(a10_), a11(a11_), b00(b00_), b10(b10_)
+            , col_ofs_c(dst_cols), col_ofs_r(dst_cols)
+            , fixed_ok( fits_fixed( double(a00_) * dst_cols ) && fits_fixed( double(a10_) * dst_cols ) )
+        {
+            if (!fixed_ok)
+                return;
+            for ( int n_c = 0; n_c < dst_cols; ++n_c ) {
+                col_ofs_c[n_c] = to_fixed( double(a00) * n_c );
+                col_ofs_r[n_c] = to_fixed( double(a10) * n_c );
+            }
+        }
+
+        // Whether destination row n_r is computed in fixed point. Decided over the whole row,
+        // so that every part of a row takes the same path however the row is split.
+        // Both coordinates are linear along a row, so checking the two ends is enough.
+        bool row_fits( const int n_r ) const {
+            const int dst_cols = static_cast<int>(col_ofs_c.size());
+            if ( !fixed_ok || dst_cols == 0 )
+                return fixed_ok;
+            const double base_c = double(a01) * n_r + b10;
+            const double base_r = double(a11) * n_r + b00;
+            return fits_fixed( base_c ) && fits_fixed( base_c + double(a00) * (dst_cols - 1) )
+                && fits_fixed( base_r ) && fits_fixed( base_r + double(a10) * (dst_cols - 1) );
+        }
+    };
+
+    // Float reference used for rows whose coordinates do not fit in 16.16.
+    inline void row_float( const int src_rows, const int src_cols, const int src_step, const float src[]
+                         , float dst_row[], const int n_r, const int c_begin, const int c_end, const transform & t
+                         )
+    {
+        for ( int n_c = c_begin; n_c < c_end; ++n_c ) {
+            const float o_r = t.a11 * n_r + t.a10 * n_c + t.b00;
+            const float o_c = t.a01 * n_r + t.a00 * n_c + t.b10;
+            const float r = o_r - std::floor(o_r);
+            const float c = o_c - std::floor(o_c);
+            const int r0 = static_cast<int>(std::floor(o_r));
+            const int c0 = static_cast<int>(std::floor(o_c));
+            const int r0c = std::min(std::max(r0    , 0), src_rows - 1);
+            const int r1c = std::min(std::max(r0 + 1, 0), src_rows - 1);
+            const int c0c = std::min(std::max(c0    , 0), src_cols - 1);
+            const int c1c = std::min(std::max(c0 + 1, 0), src_cols - 1);
+            const float A00 = src[r0c * src_step + c0c];
+            const float A01 = src[r0c * src_step + c1c];
+            const float A10 = src[r1c * src_step + c0c];
+            const float A11 = src[r1c * src_step + c1c];
+            dst_row[n_c] = (1.0f - c) * ((1.0f - r) * A00 + r * A10) + c * ((1.0f - r) * A01 + r * A11);
+        }
+    }
+
+    inline void row_fixed_scalar( const int src_rows, const int src_cols, const int src_step, const float src[]
+                                , float dst_row[], const int32_t base_r, const int32_t base_c
+                                , const int c_begin, const int c_end, const transform & t
+                                )
+    {
+        const tab_t & tab = tab_t::get();
+        for ( int n_c = c_begin; n_c < c_end; ++n_c ) {
+            const int32_t R = base_r + t.col_ofs_r[n_c];
+            const int32_t C = base_c + t.col_ofs_c[n_c];
+            const int r0 = R >> COORD_BITS;
+            const int c0 = C >> COORD_BITS;
+            const int fr = (R >> FRAC_SHIFT) & (INTER_TAB_SIZE - 1);
+            const int fc = (C >> FRAC_SHIFT) & (INTER_TAB_SIZE - 1);
+            const int r0c = std::min(std::max(r0    , 0), src_rows - 1);
+            const int r1c = std::min(std::max(r0 + 1, 0), src_rows - 1);
+            const int c0c = std::min(std::max(c0    , 0), src_cols - 1);
+            const int c1c = std::min(std::max(c0 + 1, 0), src_cols - 1);
+            const float * w = tab.w[fr * INTER_TAB_SIZE + fc];
+            dst_row[n_c] = w[0] * src[r0c * src_step + c0c] + w[1] * src[r0c * src_step + c1c]
+                         + w[2] * src[r1c * src_step + c0c] + w[3] * src[r1c * src_step + c1c];
+        }
+    }
+
+    // Computes dst_row[c_begin, c_end) of destination row n_r; fixed is t.row_fits(n_r).
+    inline void row( const int src_rows, const int src_cols, const int src_step, const float src[]
+                   , float dst_row[], const int n_r, const int c_begin, const int c_end, const transform & t, const bool fixed
+                   )
+    {
+        if (!fixed) {
+            row_float( src_rows, src_cols, src_step, src, dst_row, n_r, c_begin, c_end, t );
+            return;
+        }
+        // The rounding delta moves the quantization to round-to-nearest, the integer part stays a floor.
+        const int32_t base_r = to_fixed( double(t.a11) * n_r + t.b00 ) + ROUND_DELTA;
+        const int32_t base_c = to_fixed( double(t.a01) * n_r + t.b10 ) + ROUND_DELTA;
+        int n_c = c_begin;
+
+#if defined(__AVX2__)
+        const tab_t & tab = tab_t::get();
+        const float * w = &tab.w[0][0];
+        const __m256i vbase_r   = _mm256_set1_epi32(base_r);
+        const __m256i vbase_c   = _mm256_set1_epi32(base_c);
+        const __m256i vfrac     = _mm256_set1_epi32(INTER_TAB_SIZE - 1);
+        const __m256i vzero     = _mm256_setzero_si256();
+        const __m256i vone      = _mm256_set1_epi32(1);
+        const __m256i vmax_r    = _mm256_set1_epi32(src_rows - 1);
+        const __m256i vmax_c    = _mm256_set1_epi32(src_cols - 1);
+        const __m256i vstep     = _mm256_set1_epi32(src_step);
+        for ( ; n_c + 8 <= c_end; n_c += 8 ) {
+            const __m256i R = _mm256_add_epi32(vbase_r, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&t.col_ofs_r[n_c])));
+            const __m256i C = _mm256_add_epi32(vbase_c, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&t.col_ofs_c[n_c])));
+            const __m256i r0 = _mm256_srai_epi32(R, COORD_BITS);
+            const __m256i c0 = _mm256_srai_epi32(C, COORD_BITS);
+            const __m256i fr = _mm256_and_si256(_mm256_srai_epi32(R, FRAC_SHIFT), vfrac);
+            const __m256i fc = _mm256_and_si256(_mm256_srai_epi32(C, FRAC_SHIFT), vfrac);
+
+            const __m256i r0c = _mm256_min_epi32(_mm256_max_epi32(r0, vzero), vmax_r);
+            const __m256i r1c = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(r0, vone), vzero), vmax_r);
+            const __m256i c0c = _mm256_min_epi32(_mm256_max_epi32(c0, vzero), vmax_c);
+            const __m256i c1c = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(c0, vone), vzero), vmax_c);
+            const __m256i row0 = _mm256_mullo_epi32(r0c, vstep);
+            const __m256i row1 = _mm256_mullo_epi32(r1c, vstep);
+
+            const __m256 A00 = _mm256_i32gather_ps(src, _mm256_add_epi32(row0, c0c), 4);
+            const __m256 A01 = _mm256_i32gather_ps(src, _mm256_add_epi32(row0, c1c), 4);
+            const __m256 A10 = _mm256_i32gather_ps(src, _mm256_add_epi32(row1, c0c), 4);
+            const __m256 A11 = _mm256_i32gather_ps(src, _mm256_add_epi32(row1, c1c), 4);
+
+            const __m256i widx = _mm256_slli_epi32(_mm256_add_epi32(_mm256_slli_epi32(fr, INTER_BITS), fc), 2);
+            const __m256 w00 = _mm256_i32gather_ps(w + 0, widx, 4);
+            const __m256 w01 = _mm256_i32gather_ps(w + 1, widx, 4);
+            const __m256 w10 = _mm256_i32gather_ps(w + 2, widx, 4);
+            const __m256 w11 = _mm256_i32gather_ps(w + 3, widx, 4);
+
+            __m256 res = _mm256_mul_ps(w00, A00);
+            res = _mm256_add_ps(res, _mm256_mul_ps(w01, A01));
+            res = _mm256_add_ps(res, _mm256_mul_ps(w10, A10));
+            res = _mm256_add_ps(res, _mm256_mul_ps(w11, A11));
+            _mm256_storeu_ps(dst_row + n_c, res);
+        }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        const tab_t & tab = tab_t::get();
+        const int32x4_t vbase_r = vdupq_n_s32(base_r);
+        const int32x4_t vbase_c = vdupq_n_s32(base_c);
+        const int32x4_t vfrac   = vdupq_n_s32(INTER_TAB_SIZE - 1);
+        const int32x4_t vzero   = vdupq_n_s32(0);
+        const int32x4_t vone    = vdupq_n_s32(1);
+        const int32x4_t vmax_r  = vdupq_n_s32(src_rows - 1);
+        const int32x4_t vmax_c  = vdupq_n_s32(src_cols - 1);
+        for ( ; n_c + 8 <= c_end; n_c += 8 ) {
+            for ( int half = 0; half < 8; half += 4 ) {
+                const int32x4_t R = vaddq_s32(vbase_r, vld1q_s32(&t.col_ofs_r[n_c + half]));
+                const int32x4_t C = vaddq_s32(vbase_c, vld1q_s32(&t.col_ofs_c[n_c + half]));
+                const int32x4_t r0 = vshrq_n_s32(R, COORD_BITS);
+                const int32x4_t c0 = vshrq_n_s32(C, COORD_BITS);
+                const int32x4_t fr = vandq_s32(vshrq_n_s32(R, FRAC_SHIFT), vfrac);
+                const int32x4_t fc = vandq_s32(vshrq_n_s32(C, FRAC_SHIFT), vfrac);
+
+                const int32x4_t r0c = vminq_s32(vmaxq_s32(r0, vzero), vmax_r);
+                const int32x4_t r1c = vminq_s32(vmaxq_s32(vaddq_s32(r0, vone), vzero), vmax_r);
+                const int32x4_t c0c = vminq_s32(vmaxq_s32(c0, vzero), vmax_c);
+                const int32x4_t c1c = vminq_s32(vmaxq_s32(vaddq_s32(c0, vone), vzero), vmax_c);
+                const int32x4_t row0 = vmulq_n_s32(r0c, src_step);
+                const int32x4_t row1 = vmulq_n_s32(r1c, src_step);
+
+                int32_t i00[4], i01[4], i10[4], i11[4], iw[4];
+                vst1q_s32(i00, vaddq_s32(row0, c0c));
+                vst1q_s32(i01, vaddq_s32(row0, c1c));
+                vst1q_s32(i10, vaddq_s32(row1, c0c));
+                vst1q_s32(i11, vaddq_s32(row1, c1c));
+                vst1q_s32(iw , vaddq_s32(vshlq_n_s32(fr, INTER_BITS), fc));
+
+                float32x4_t A00 = vdupq_n_f32(0.0f), A01 = A00, A10 = A00, A11 = A00;
+                float32x4x4_t wv;
+#define WARPAFFINE_FIXED_LANE(l) \
+                A00 = vld1q_lane_f32(src + i00[l], A00, l); \
+                A01 = vld1q_lane_f32(src + i01[l], A01, l); \
+                A10 = vld1q_lane_f32(src + i10[l], A10, l); \
+                A11 = vld1q_lane_f32(src + i11[l], A11, l);
+                WARPAFFINE_FIXED_LANE(0)
+                WARPAFFINE_FIXED_LANE(1)
+                WARPAFFINE_FIXED_LANE(2)
+                WARPAFFINE_FIXED_LANE(3)
+#undef WARPAFFINE_FIXED_LANE
+                // de-interleaving load of the four weight quadruples
+                {
+                    float wbuf[16];
+                    for ( int l = 0; l < 4; ++l )
+                        for ( int k = 0; k < 4; ++k )
+                            wbuf[l * 4 + k] = tab.w[iw[l]][k];
+                    wv = vld4q_f32(wbuf);
+                }
+                float32x4_t res = vmulq_f32(wv.val[0], A00);
+                res = vmlaq_f32(res, wv.val[1], A01);
+                res = vmlaq_f32(res, wv.val[2], A10);
+                res = vmlaq_f32(res, wv.val[3], A11);
+                vst1q_f32(dst_row + n_c + half, res);
+            }
+        }
+#endif
+        row_fixed_scalar( src_rows, src_cols, src_step, src, dst_row, base_r, base_c, n_c, c_end, t );
+    }
+}
+
+// Same interface as pencil_affine_linear, including its replicated border.
+inline void affine_linear_fixed( const int src_rows, const int src_cols, const int src_step, const float src[]
+                               , const int dst_rows, const int dst_cols, const int dst_step,       float dst[]
+                               , const float a00, const float a01, const float a10, const float a11, const float b00, const float b10
+                               )
+{
+    const affine_fixed::transform t( dst_cols, a00, a01, a10, a11, b00, b10 );
+    for ( int n_r = 0; n_r < dst_rows; ++n_r )
+        affine_fixed::row( src_rows, src_cols, src_step, src, dst + n_r * dst_step, n_r, 0, dst_cols, t, t.row_fits(n_r) );
+}
+
+} // namespace carp
+
+#endif // WARPAFFINE_FIXED_HPP